@@ -0,0 +1,64 @@
+/****************************************************************************/
+
+/*
+ *	boottrace.h -- Where the time goes between the ROM and a login.
+ *
+ * 	(C) Copyright 2010 Brian S. Julin (bri@abrij.org)
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file "COPYING" in the main directory of this archive
+ * for more details.
+ */
+
+/****************************************************************************/
+#ifndef	dj_boottrace_h
+#define	dj_boottrace_h
+/****************************************************************************/
+
+/*
+ * Fixed points along the way up, each stamped once with the free
+ * running DJIO_A_TIMER_COUNTER into dj_boottrace_stamps[].  head.S
+ * takes the first DJ_BT_NHEAD itself, before there is a bss, so the
+ * array lives in its .data, and init/main.c takes the last.  With
+ * CONFIG_DJ_BOOTTRACE, do_one_initcall() has platform/dj/boottrace.c
+ * stamp either side of every initcall too, and it shows the lot in
+ * /proc/dj_boottrace.
+ */
+#define DJ_BT_START		0	/* _start */
+#define DJ_BT_SETUP		1	/* PLATFORM_SETUP done */
+#define DJ_BT_ROMFS		2	/* ROMFS moved above the bss */
+#define DJ_BT_KERNEL		3	/* start_kernel */
+#define DJ_BT_NHEAD		4
+#define DJ_BT_TIMER		4	/* hw_timer_init, counter rate changes */
+#define DJ_BT_UDC		5	/* udc_init_module */
+#define DJ_BT_BIND		6	/* gadget driver bound to the UDC */
+#define DJ_BT_CONSOLE		7	/* init_post opened /dev/console */
+#define DJ_BT_NPOINTS		8
+
+#ifndef __ASSEMBLY__
+
+#include <linux/init.h>
+#include <linux/io.h>
+#include <asm/dj/djio.h>
+#include <asm/dj/timer.h>
+
+extern unsigned long dj_boottrace_stamps[DJ_BT_NPOINTS];
+
+/* The counter divider the ROM left, until DJ_BT_TIMER; timer.c sets it */
+extern unsigned int dj_boottrace_romdiv;
+
+/* What do_one_initcall() runs an initcall with */
+extern int dj_boottrace_initcall(initcall_t fn);
+
+/* Only the first time counts; a few of these are on paths taken again */
+static inline void dj_boottrace(int point)
+{
+	if (!dj_boottrace_stamps[point])
+		dj_boottrace_stamps[point] =
+			readl(DJIO_A_TIMER + DJIO_A_TIMER_COUNTER);
+}
+
+#endif /* __ASSEMBLY__ */
+
+/****************************************************************************/
+#endif	/* dj_boottrace_h */
@@ -0,0 +1,90 @@
+/****************************************************************************/
+
+/*
+ *	ecpboot.h -- Wire format for the two-stage ECP bootstrap.
+ *
+ * 	(C) Copyright 2009-2010 Brian S. Julin (bri@abrij.org)
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file "COPYING" in the main directory of this archive
+ * for more details.
+ */
+
+/****************************************************************************/
+#ifndef	dj_ecpboot_h
+#define	dj_ecpboot_h
+/****************************************************************************/
+
+/*
+ * The boot ROM only takes S-records in compatibility mode, which is
+ * slow and more than doubles what goes down the cable.  So all it gets
+ * now is platform/dj/ecpboot, a few KiB that sets up the P1284 block and
+ * then takes the kernel as binary over forward ECP, in blocks packed
+ * with asm/dj/lz.h.  The host side is tools/ecpboot.c.
+ *
+ * Everything is ECP data bytes, big-endian; command bytes are ignored.
+ * The host sends a header:
+ *
+ *	magic, load address, entry point, unpacked size, block count,
+ *	CRC32 of the whole unpacked image		(6 x 4 bytes)
+ *
+ * and reverses the bus for one status byte: ACK, or FAIL if the image
+ * won't fit below the loader.  Then it sends each block, with a header
+ * of its own:
+ *
+ *	block number (4), packed length (2), unpacked length (2),
+ *	CRC32 of the packed bytes (4), then the packed bytes
+ *
+ * Block n unpacks to load + n * ECPBOOT_BLOCK and is at most that long.
+ * After each block the host reverses the bus for one status byte: ACK,
+ * or NAK to have it sent again.  After the last one the loader checks
+ * the image CRC and sends GO and jumps to the entry point, or sends FAIL
+ * and waits for a new header.
+ */
+#define ECPBOOT_MAGIC		0x444a4231	/* "DJB1" */
+#define ECPBOOT_HDR_LEN		24
+#define ECPBOOT_BLK_HDR_LEN	12
+#define ECPBOOT_BLOCK		32768		/* unpacked bytes per block */
+/* A block that doesn't pack goes as literals, which costs a little */
+#define ECPBOOT_PACKED_MAX	(ECPBOOT_BLOCK + ECPBOOT_BLOCK / 255 + 16)
+
+#define ECPBOOT_ACK		'+'
+#define ECPBOOT_NAK		'-'
+#define ECPBOOT_GO		'G'
+#define ECPBOOT_FAIL		'!'
+
+/* Where the loader sits: the top 64 KiB of RAM, clear of the kernel */
+#define ECPBOOT_BASE		0x021f0000
+#define ECPBOOT_LOAD		0x02010000	/* CONFIG_KERNELBASE */
+
+/*
+ * CRC32 (the zlib one, reflected 0xedb88320), bytewise off a table the
+ * caller fills in once with ecpboot_crc_init().  Kept here so both ends
+ * agree; nothing in it needs more than ANSI C.
+ */
+static inline void ecpboot_crc_init(unsigned long *tab)
+{
+	unsigned long c;
+	int n, k;
+
+	for (n = 0; n < 256; n++) {
+		c = n;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+		tab[n] = c;
+	}
+}
+
+static inline unsigned long ecpboot_crc(const unsigned long *tab,
+					unsigned long crc,
+					const unsigned char *p,
+					unsigned long len)
+{
+	crc = ~crc & 0xffffffffUL;
+	while (len--)
+		crc = tab[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc & 0xffffffffUL;
+}
+
+/****************************************************************************/
+#endif	/* dj_ecpboot_h */
@@ -0,0 +1,58 @@
+/****************************************************************************/
+
+/*
+ *	flatcache.h -- Shared, already relocated text for flat binaries.
+ *
+ * 	(C) Copyright 2010 Brian S. Julin (bri@abrij.org)
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file "COPYING" in the main directory of this archive
+ * for more details.
+ */
+
+/****************************************************************************/
+#ifndef	dj_flatcache_h
+#define	dj_flatcache_h
+/****************************************************************************/
+
+/*
+ * binfmt_flat reads a FLAT_FLAG_RAM binary's text into fresh memory and
+ * relocates it at every exec, so each busybox applet in a script costs
+ * a read and a relocation pass over all of busybox's text, and each
+ * running one its own copy.  platform/dj/flatcache.c keeps one
+ * relocated copy of the text per inode instead and hands that out, as
+ * long as no text relocation points into data, which would be
+ * different for every process.
+ *
+ * When dj_flatcache_text() gives binfmt_flat a text, it takes the same
+ * path as for text mapped from ROM: only data and bss are allocated and
+ * read, and only the relocations that land in data are done.  It turns
+ * FLAT_FLAG_RAM into DJ_FLAT_FLAG_CACHED in its flags for that, which
+ * is no bit the header uses.  The text is held for the mm it went to
+ * until destroy_context() calls dj_flatcache_put() for that mm.
+ */
+#define DJ_FLAT_FLAG_CACHED	0x80000000
+#define DJ_FLATCACHE_MAX_KB	1024		/* default limit on the texts */
+#define DJ_FLATCACHE_MAX_FILES	64		/* and on the files known */
+
+struct file;
+struct flat_hdr;
+struct mm_struct;
+
+#ifdef CONFIG_DJ_FLATCACHE
+extern unsigned long dj_flatcache_text(struct file *file,
+				       struct flat_hdr *hdr);
+extern void dj_flatcache_put(struct mm_struct *mm);
+#else
+static inline unsigned long dj_flatcache_text(struct file *file,
+					      struct flat_hdr *hdr)
+{
+	return 0;
+}
+static inline void dj_flatcache_put(struct mm_struct *mm)
+{
+}
+#endif
+
+/****************************************************************************/
+#endif	/* dj_flatcache_h */
@@ -28,10 +28,50 @@
 
 /* Access of per-line registers */
 #define DJIO_A_IRQ_NIRQ             0x13  /* there may be more ???            */
+#define DJIO_A_IRQ_NLINES           0x14  /* lines we drive, up to timer B's  */
 #define DJIO_A_IRQ_N(N)             (DJIO_A_IRQ_IRQN + (N))
 
+/*
+ * Priorities lines get when unmasked, which are also the CPU levels
+ * they come in at.  platform/dj/irq.c maps the lines it knows to these,
+ * and anything else gets the default.  7 would be the ColdFire's
+ * unmaskable level, so it isn't given out.
+ */
+#define DJ_IRQ_PRIO_DEFAULT         2   /* USB, and lines nobody knows     */
+#define DJ_IRQ_PRIO_TIMER           5   /* timers A to E                   */
+#define DJ_IRQ_PRIO_MOTION          6   /* motors, steppers and encoders   */
+#define DJ_IRQ_PRIO_MAX             6
+
 /* Offset of IRQ lines numbers to system vector numbers */
 #define DJIO_IRQ_BASE		    0x40
 
+#ifndef __ASSEMBLY__
+/* All lines off, for a warm reload */
+extern void dj_irq_quiesce(void);
+
+/* A line's priority from now on; 0, or -EINVAL for a bad line or prio */
+extern int dj_irq_set_prio(unsigned int irq, unsigned int prio);
+
+/* And what it is now, or -EINVAL for a bad line */
+extern int dj_irq_get_prio(unsigned int irq);
+
+/*
+ * Fast interrupts, straight from the vector to the handler through
+ * platform/dj/fastirq.S, with no pt_regs, do_IRQ() or genirq on the way.
+ * The handler runs at its line's level, on whatever stack was in use,
+ * and must quiet its source before it returns; the line's eoi comes
+ * after.  Off the kernel stack current is garbage, so nothing that
+ * sleeps, wakes, locks or counts preemption: anything like that goes
+ * to a tasklet through dj_fast_irq_defer().
+ */
+struct tasklet_struct;
+typedef void (*dj_fast_handler_t)(void *dev);
+
+extern int dj_fast_irq_request(unsigned int irq, dj_fast_handler_t handler,
+			       void *dev, const char *name);
+extern void dj_fast_irq_free(unsigned int irq);
+extern void dj_fast_irq_defer(struct tasklet_struct *t);
+#endif
+
 /****************************************************************************/
 #endif	/* dj_irq_h */
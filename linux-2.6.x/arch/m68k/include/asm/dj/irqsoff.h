@@ -0,0 +1,77 @@
+/****************************************************************************/
+
+/*
+ *	irqsoff.h -- Timing every stretch with interrupts off.
+ *
+ * 	(C) Copyright 2010 Brian S. Julin (bri@abrij.org)
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file "COPYING" in the main directory of this archive
+ * for more details.
+ */
+
+/****************************************************************************/
+#ifndef	dj_irqsoff_h
+#define	dj_irqsoff_h
+/****************************************************************************/
+
+/*
+ * With CONFIG_DJ_IRQSOFF, asm/system_no.h includes this once it has
+ * defined its own local_irq_*(), and these take their place: the same
+ * SR moves, with a call to platform/dj/irqsoff.c after every disable
+ * and before every enable or restore, given the SR before or after and
+ * the address of the caller's code.  A window starts when the level
+ * goes to 7 from anything lower and ends when it drops again.  Anything
+ * that was inlined from system_no.h before here, and entry.S's own
+ * moves, go untimed; entry.S calls dj_irqsoff_rte() before its rte so
+ * a window the rte ends is still counted.
+ */
+
+#ifndef __ASSEMBLY__
+
+extern void dj_irqsoff_off(unsigned long flags, unsigned long ip);
+extern void dj_irqsoff_on(unsigned long flags, unsigned long ip);
+extern void dj_irqsoff_rte(unsigned long sr);
+
+/* As linux/kernel.h's _THIS_IP_, which isn't to be had this early */
+#define DJ_IRQSOFF_IP()	({ __label__ __here; __here: (unsigned long)&&__here; })
+
+#define dj_irqsoff_set_sr(x) \
+	asm volatile ("movew %0,%%sr" : : "d" (x) : "memory")
+
+#undef local_irq_enable
+#undef local_irq_disable
+#undef local_irq_save
+#undef local_irq_restore
+
+#define local_irq_disable() do {					\
+	unsigned long __dj_sr;						\
+	local_save_flags(__dj_sr);					\
+	dj_irqsoff_set_sr(__dj_sr | 0x0700);				\
+	dj_irqsoff_off(__dj_sr, DJ_IRQSOFF_IP());			\
+} while (0)
+
+#define local_irq_save(x) do {						\
+	local_save_flags(x);						\
+	dj_irqsoff_set_sr((x) | 0x0700);				\
+	dj_irqsoff_off(x, DJ_IRQSOFF_IP());				\
+} while (0)
+
+#define local_irq_enable() do {						\
+	unsigned long __dj_sr;						\
+	local_save_flags(__dj_sr);					\
+	__dj_sr &= ~0x0700;						\
+	dj_irqsoff_on(__dj_sr, DJ_IRQSOFF_IP());			\
+	dj_irqsoff_set_sr(__dj_sr);					\
+} while (0)
+
+#define local_irq_restore(x) do {					\
+	unsigned long __dj_sr = (x);					\
+	dj_irqsoff_on(__dj_sr, DJ_IRQSOFF_IP());			\
+	dj_irqsoff_set_sr(__dj_sr);					\
+} while (0)
+
+#endif /* __ASSEMBLY__ */
+
+/****************************************************************************/
+#endif	/* dj_irqsoff_h */
@@ -0,0 +1,91 @@
+/****************************************************************************/
+
+/*
+ *	lz.h -- LZ77 block decompressor for the Deskjet boot paths.
+ *
+ * 	(C) Copyright 2009-2010 Brian S. Julin (bri@abrij.org)
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file "COPYING" in the main directory of this archive
+ * for more details.
+ */
+
+/****************************************************************************/
+#ifndef	dj_lz_h
+#define	dj_lz_h
+/****************************************************************************/
+
+/*
+ * The format is LZ4's block format, so the packer can be anything that
+ * writes that; tools/ecpboot.c has a small one.  A block is a list of
+ * sequences, each:
+ *
+ *	token: literal count in the high nibble, match length - 4 in the low
+ *	more literal count bytes if that nibble was 15, each added in,
+ *	    until one is not 255
+ *	the literals
+ *	2 byte little-endian offset back from here to copy the match from
+ *	more match length bytes as for the literal count
+ *
+ * The last sequence is literals only and stops at the end of the block.
+ * Matches can overlap what they write, which is how runs come out.
+ *
+ * This has to run before anything else is set up, in the ECP loader
+ * and in zboot, so it is plain C with no library calls, and it does
+ * not trust its input: a bad block gets -1, never a write outside dst.
+ */
+#define DJ_LZ_MINMATCH		4
+
+static inline long dj_lz_unpack(const unsigned char *src, unsigned long srclen,
+				unsigned char *dst, unsigned long dstlen)
+{
+	const unsigned char *ip = src, *iend = src + srclen, *m;
+	unsigned char *op = dst, *oend = dst + dstlen;
+	unsigned long len, off;
+	unsigned int token, b;
+
+	while (ip < iend) {
+		token = *ip++;
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (ip == iend)
+					return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		if (len > (unsigned long)(iend - ip) ||
+		    len > (unsigned long)(oend - op))
+			return -1;
+		while (len--)
+			*op++ = *ip++;
+		if (ip == iend)
+			break;
+		if (iend - ip < 2)
+			return -1;
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (!off || off > (unsigned long)(op - dst))
+			return -1;
+		len = token & 15;
+		if (len == 15) {
+			do {
+				if (ip == iend)
+					return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += DJ_LZ_MINMATCH;
+		if (len > (unsigned long)(oend - op))
+			return -1;
+		m = op - off;
+		while (len--)
+			*op++ = *m++;
+	}
+	return op - dst;
+}
+
+/****************************************************************************/
+#endif	/* dj_lz_h */
@@ -0,0 +1,108 @@
+/****************************************************************************/
+
+/*
+ *	dj_p1284.h -- Definitions for HP Deskjet peripheral-side p1284 support.
+ *
+ * 	(C) Copyright 2009-2010 Brian S. Julin (bri@abrij.org)
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file "COPYING" in the main directory of this archive
+ * for more details.
+ */
+
+/****************************************************************************/
+#ifndef	dj_p1284_h
+#define	dj_p1284_h
+/****************************************************************************/
+
+/*
+ * REGISTERS
+ *
+ * The base address DJIO_A_P1284 should be defined before including this
+ * file.  All register identifiers are relative to that base address.
+ */
+#define DJIO_A_P1284_DATA          0x00  /* read/write levels of 8 data pins */
+#define DJIO_A_P1284_CNTL          0x02  /* control of host status signals */
+#define DJIO_A_P1284_CFG1          0x03  /* data reverse mode, other config */
+#define DJIO_A_P1284_STAT          0x07  /* status of host control signals */
+
+/*
+ * Note we are on the peripheral end of the cable, so the names normally
+ * used for outputs are stat register inputs, and visa versa.
+ */
+
+/*
+ * Bitfields within DJIO_A_P1284_STAT.  The number is the 1284-A pin.
+ */
+#define DJIO_A_P1284_STAT_16       0x01  /* INIT/ReverseRequest            */
+#define DJIO_A_P1284_STAT_01       0x02  /* STROBE/WRITE/HostClk           */
+#define DJIO_A_P1284_STAT_14       0x04  /* AUTOFD/DSTROBE/HostAck         */
+#define DJIO_A_P1284_STAT_17       0x08  /* SelectIn/ASTROBE/1284 Active   */
+#define DJIO_A_P1284_STAT_MASK     0x0f  /* For discarding other bits      */
+
+/*
+ * Bitfields within DJIO_A_P1284_CNTL.  The number is the 1284-A pin.
+ */
+#define DJIO_A_P1284_CNTL_15       0x01  /* FAULT/PeriphRequest            */
+#define DJIO_A_P1284_CNTL_13       0x02  /* Select/XFlag                   */
+#define DJIO_A_P1284_CNTL_12       0x04  /* PError/AckReverse              */
+#define DJIO_A_P1284_CNTL_11       0x08  /* BUSY/WAIT/PeriphAck            */
+#define DJIO_A_P1284_CNTL_10       0x10  /* ACK/INTR/PeriphClk             */
+
+/*
+ * Bitfields within DJIO_A_P1284_CTL1.  Reverse tristate and other configs.
+ */
+#define DJIO_A_P1284_CTL1_DDRV     0x80  /* Untristate DATA, "reverse" drive.*/
+
+/*
+ * Reverse ECP handshake states: what we drive on CNTL, and what we wait
+ * to see on STAT, at each step of sending the host a byte.  Shared by
+ * platform/dj/p1284.c and the ECP boot loader.
+ */
+#define REVERSEREQ_I2 (DJIO_A_P1284_STAT_01 | DJIO_A_P1284_STAT_17)
+#define REVERSEREQ_I1 (REVERSEREQ_I2  | DJIO_A_P1284_STAT_16)
+#define REVERSEREQ_I3 (REVERSEREQ_I2  | DJIO_A_P1284_STAT_14)
+
+#define REVERSEREQ_O4 (DJIO_A_P1284_CNTL_13)
+#define REVERSEREQ_O3 (REVERSEREQ_O4 | DJIO_A_P1284_CNTL_10)
+#define REVERSEREQ_O2 (REVERSEREQ_O3 | DJIO_A_P1284_CNTL_12)
+#define REVERSEREQ_O1 (REVERSEREQ_O2 | DJIO_A_P1284_CNTL_15)
+
+/*
+ * PeriphAck while the byte is on the bus.  Data has always gone out
+ * with it clear and the host took it as data, so set is a command.
+ */
+#define REVERSEREQ_CMD (DJIO_A_P1284_CNTL_11)
+
+/* Handshake steps give up after this many status polls */
+#define DJ_P1284_SPIN 5000
+
+
+/****************************************************************************/
+
+/*
+ * ECP CHANNELS
+ *
+ * Streams multiplexed over the link.  A command byte of 0x80 | channel
+ * in either direction switches what the data bytes after it belong to.
+ * One with bit 7 clear is an RLE count for the data byte after it.
+ * The host side (tools/ecprxtx.c) uses the same numbers.
+ */
+#define DJ_P1284_CH_CONSOLE        0     /* interactive tty, /dev/ttyP0  */
+#define DJ_P1284_CH_BULK           1     /* file transfer tty, /dev/ttyP1 */
+#define DJ_P1284_CH_KLOG           2     /* kernel log, reverse only     */
+#define DJ_P1284_NCHAN             3
+#define DJ_P1284_NTTY              2     /* channels with a tty          */
+#define DJ_P1284_CH_RELOAD         3     /* new kernel, forward only, see
+					    asm/dj/reload.h             */
+
+#define DJ_P1284_CMD_CHAN          0x80  /* command byte: channel address */
+
+/****************************************************************************/
+
+/* prototype for setup */
+struct console;
+extern int setup_dj_p1284_console(void);
+extern void dj_p1284_console_write (struct console *co, const char *s,
+			            unsigned count);
+#endif	/* dj_p1284_h */
@@ -0,0 +1,51 @@
+/****************************************************************************/
+
+/*
+ *	reload.h -- Warm reload of a new kernel image into a running DeskJet.
+ *
+ * 	(C) Copyright 2010 Brian S. Julin (bri@abrij.org)
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file "COPYING" in the main directory of this archive
+ * for more details.
+ */
+
+/****************************************************************************/
+#ifndef	dj_reload_h
+#define	dj_reload_h
+/****************************************************************************/
+
+/*
+ * platform/dj/reload.c keeps a buffer aside from boot, takes an image
+ * into it from ECP channel DJ_P1284_CH_RELOAD or from /dev/djreload,
+ * and once it is all there and its CRC checks out, shuts the machine
+ * down as far as a restart would and jumps into it.  No button holding,
+ * no power cycle, no boot ROM.  The host side is "tools/ecpboot -w".
+ *
+ * The image goes with a header, all big-endian:
+ *
+ *	magic, load address, entry point, size,
+ *	CRC32 of the image, as in asm/dj/ecpboot.h	(5 x 4 bytes)
+ *
+ * Bytes that don't start a header are skipped until one does.  The
+ * reserve is only so big (dj_reload.size, in KiB), so the image is
+ * normally zImage.bin from platform/dj/zboot, which loads and starts at
+ * CONFIG_KERNELBASE just as it does from the ROM.
+ */
+#define DJ_RELOAD_MAGIC		0x444a5231	/* "DJR1" */
+#define DJ_RELOAD_HDR_LEN	20
+#define DJ_RELOAD_SIZE_KB	512		/* default reserve */
+
+#ifdef __KERNEL__
+#ifdef CONFIG_DJ_RELOAD
+extern int dj_reload_write(const u8 *p, size_t n);
+#else
+static inline int dj_reload_write(const u8 *p, size_t n)
+{
+	return -ENODEV;
+}
+#endif
+#endif
+
+/****************************************************************************/
+#endif	/* dj_reload_h */
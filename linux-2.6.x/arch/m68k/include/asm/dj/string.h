@@ -0,0 +1,41 @@
+/****************************************************************************/
+
+/*
+ *	string.h -- The DeskJet's own string routines, in platform/dj/string.S.
+ *
+ * 	(C) Copyright 2010 Brian S. Julin (bri@abrij.org)
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file "COPYING" in the main directory of this archive
+ * for more details.
+ */
+
+/****************************************************************************/
+#ifndef	dj_string_h
+#define	dj_string_h
+/****************************************************************************/
+
+/*
+ * asm/string_no.h includes this for CONFIG_DJ in place of its inline
+ * strcpy, strcmp and strncmp.  The ones in string.S are ISA_A clean and
+ * go a long word at a time where the alignment lets them; with these
+ * defined, lib/string.c leaves them out, and m68k_ksyms.c exports what
+ * it didn't already.  strncpy stays string_no.h's inline one.
+ */
+#define __HAVE_ARCH_STRLEN
+extern size_t strlen(const char *s);
+
+#define __HAVE_ARCH_STRCPY
+extern char *strcpy(char *dest, const char *src);
+
+#define __HAVE_ARCH_STRCMP
+extern int strcmp(const char *cs, const char *ct);
+
+#define __HAVE_ARCH_STRNCMP
+extern int strncmp(const char *cs, const char *ct, size_t count);
+
+#define __HAVE_ARCH_MEMCHR
+extern void *memchr(const void *s, int c, size_t n);
+
+/****************************************************************************/
+#endif	/* dj_string_h */
@@ -66,4 +66,16 @@
 /* Reasonable minimum one-shot delta that will result in accurate expiry      */
 #define DJ_TIMER_MIN_DELTA_NS (150000)
 
+/* Counter clicks at divider div to us, multiplying before the divide       */
+#define DJ_CLICKS_TO_US(clicks, div) (((clicks) * (div)) / 16)
+
+#ifndef __ASSEMBLY__
+/* All timers stopped, for a warm reload */
+extern void dj_timer_quiesce(void);
+/* What the counter divides 16 MHz by right now */
+extern unsigned int dj_timer_counter_div(void);
+/* A countdown timer's IRQ source on or off, tidx 0 to 4 for A to E */
+extern void dj_timer_frob_enab(int tidx, int enab);
+#endif
+
 #endif	/* dj_timer_h */
@@ -0,0 +1,163 @@
+/***************************************************************************/
+
+/*
+ *	dj/boottrace.c -- Boot timeline off the ASIC's free running counter.
+ *
+ *	Copyright (C) 2010, Brian S. Julin <bri@abrij.org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston MA 02111-1307, USA.
+ *
+ */
+
+/***************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+#include <asm/dj/djio.h>
+#include <asm/dj/timer.h>
+#include <asm/dj/boottrace.h>
+
+/*
+ * Initcalls we keep stamps for; the ones after that still run, they
+ * just aren't timed.  Twelve bytes each, for good, so not too many.
+ */
+#define DJ_BT_MAX_INITCALLS	320
+
+struct dj_bt_call {
+	initcall_t fn;
+	unsigned long t0, t1;
+};
+
+static struct dj_bt_call dj_bt_calls[DJ_BT_MAX_INITCALLS];
+static int dj_bt_ncalls, dj_bt_untimed;
+
+static const char *dj_bt_names[DJ_BT_NPOINTS] = {
+	[DJ_BT_START]	= "_start",
+	[DJ_BT_SETUP]	= "PLATFORM_SETUP done",
+	[DJ_BT_ROMFS]	= "ROMFS copied",
+	[DJ_BT_KERNEL]	= "start_kernel",
+	[DJ_BT_TIMER]	= "hw_timer_init",
+	[DJ_BT_UDC]	= "udc_init_module",
+	[DJ_BT_BIND]	= "gadget bound",
+	[DJ_BT_CONSOLE]	= "/dev/console opened",
+};
+
+/***************************************************************************/
+
+/**
+ * dj_bt_usecs: a stamp in microseconds since _start
+ * @t: counter value
+ *
+ * The counter ticks at 16 MHz over the ROM's divider until
+ * hw_timer_init() and over CONFIG_DJ_COUNTER_DIV from then on, without
+ * starting over; DJ_BT_TIMER is where it changed.  Good for a few
+ * minutes of boot before the multiply wraps.
+ */
+static unsigned long dj_bt_usecs(unsigned long t)
+{
+	unsigned long *s = dj_boottrace_stamps;
+	unsigned long romdiv = dj_boottrace_romdiv;
+
+	if (!romdiv)		/* still at the ROM's rate */
+		romdiv = dj_timer_counter_div();
+	if (!s[DJ_BT_TIMER] || t <= s[DJ_BT_TIMER])
+		return DJ_CLICKS_TO_US(t - s[DJ_BT_START], romdiv);
+	return DJ_CLICKS_TO_US(s[DJ_BT_TIMER] - s[DJ_BT_START], romdiv) +
+		DJ_CLICKS_TO_US(t - s[DJ_BT_TIMER], CONFIG_DJ_COUNTER_DIV);
+}
+
+/***************************************************************************/
+
+/**
+ * dj_boottrace_initcall: run an initcall, stamping either side of it
+ * @fn: the initcall
+ *
+ * init/main.c's do_one_initcall() calls this in place of fn().  Module
+ * inits go through there too, so once init has its console we stop
+ * keeping stamps and only run them.
+ */
+int __init_or_module dj_boottrace_initcall(initcall_t fn)
+{
+	struct dj_bt_call *c;
+	int ret;
+
+	if (dj_boottrace_stamps[DJ_BT_CONSOLE])
+		return fn();
+	if (dj_bt_ncalls == DJ_BT_MAX_INITCALLS) {
+		dj_bt_untimed++;
+		return fn();
+	}
+	c = &dj_bt_calls[dj_bt_ncalls++];
+	c->fn = fn;
+	c->t0 = readl(DJIO_A_TIMER + DJIO_A_TIMER_COUNTER);
+	ret = fn();
+	c->t1 = readl(DJIO_A_TIMER + DJIO_A_TIMER_COUNTER);
+	return ret;
+}
+
+/***************************************************************************/
+
+/* /proc/dj_boottrace: the fixed points, then the initcalls in order */
+
+static int dj_bt_show(struct seq_file *m, void *v)
+{
+	unsigned long *s = dj_boottrace_stamps, prev = 0, us;
+	int i;
+
+	seq_printf(m, "%10s %10s  %s\n", "usecs", "delta", "point");
+	for (i = 0; i < DJ_BT_NPOINTS; i++) {
+		if (!s[i]) {
+			seq_printf(m, "%10s %10s  %s\n", "-", "-", dj_bt_names[i]);
+			continue;
+		}
+		us = dj_bt_usecs(s[i]);
+		seq_printf(m, "%10lu %10lu  %s\n", us, us - prev, dj_bt_names[i]);
+		prev = us;
+	}
+
+	seq_printf(m, "\n%10s %10s  %s\n", "usecs", "took", "initcall");
+	for (i = 0; i < dj_bt_ncalls; i++) {
+		us = dj_bt_usecs(dj_bt_calls[i].t0);
+		seq_printf(m, "%10lu %10lu  %pF\n", us,
+			   dj_bt_usecs(dj_bt_calls[i].t1) - us,
+			   dj_bt_calls[i].fn);
+	}
+	if (dj_bt_untimed)
+		seq_printf(m, "(%d more, not timed)\n", dj_bt_untimed);
+	return 0;
+}
+
+static int dj_bt_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dj_bt_show, NULL);
+}
+
+static const struct file_operations dj_bt_fops = {
+	.open		= dj_bt_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init dj_boottrace_proc_init(void)
+{
+	proc_create("dj_boottrace", 0444, NULL, &dj_bt_fops);
+	return 0;
+}
+
+device_initcall(dj_boottrace_proc_init);
+
+/***************************************************************************/
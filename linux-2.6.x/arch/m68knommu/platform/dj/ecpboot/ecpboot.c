@@ -0,0 +1,220 @@
+/***************************************************************************/
+
+/*
+ *	ecpboot.c -- Take a packed kernel over ECP and jump into it.
+ *
+ *	Copyright (C) 2010, Brian S. Julin <bri@abrij.org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston MA 02111-1307, USA.
+ *
+ */
+
+/***************************************************************************/
+
+/*
+ * The boot ROM sends us here from the S7 record at the end of
+ * ecpboot.srec.  We run polled, with interrupts off, from the top of RAM;
+ * the protocol is in asm/dj/ecpboot.h and the byte handshakes are the
+ * ones platform/dj/p1284.c uses, without the kernel around them.
+ */
+
+#include <asm/dj/djio.h>
+#include <asm/dj/p1284.h>
+#include <asm/dj/ecpboot.h>
+#include <asm/dj/lz.h>
+
+#define P1284_REG(r)	(*(volatile unsigned char *)(DJIO_A_P1284 + (r)))
+
+static unsigned long crctab[256];
+static unsigned char blk[ECPBOOT_PACKED_MAX];
+
+/***************************************************************************/
+
+/* Register access */
+
+static inline unsigned char read_stat(void)
+{
+	return P1284_REG(DJIO_A_P1284_STAT) & DJIO_A_P1284_STAT_MASK;
+}
+
+static inline void write_cntl(unsigned char v)
+{
+	P1284_REG(DJIO_A_P1284_CNTL) = v;
+}
+
+static inline void frob_cntl(unsigned char v, unsigned char mask)
+{
+	P1284_REG(DJIO_A_P1284_CNTL) =
+		(P1284_REG(DJIO_A_P1284_CNTL) & ~mask) | (v & mask);
+}
+
+static inline void frob_cfg1(unsigned char v, unsigned char mask)
+{
+	P1284_REG(DJIO_A_P1284_CFG1) =
+		(P1284_REG(DJIO_A_P1284_CFG1) & ~mask) | (v & mask);
+}
+
+/***************************************************************************/
+
+/* Byte level ECP, waiting for as long as it takes */
+
+/* One forward data byte; command bytes are skipped */
+static unsigned char getd(void)
+{
+	unsigned char st, c;
+	int i;
+
+	for (;;) {
+		st = read_stat();
+		if ((st & (DJIO_A_P1284_STAT_01 | DJIO_A_P1284_STAT_16 |
+			   DJIO_A_P1284_STAT_17)) !=
+		    (DJIO_A_P1284_STAT_16 | DJIO_A_P1284_STAT_17))
+			continue;
+		c = P1284_REG(DJIO_A_P1284_DATA);
+		frob_cntl(DJIO_A_P1284_CNTL_11, DJIO_A_P1284_CNTL_11);
+		i = DJ_P1284_SPIN;
+		while (--i) {
+			if (read_stat() & DJIO_A_P1284_STAT_01) break;
+		}
+		frob_cntl(0, DJIO_A_P1284_CNTL_11);
+		if (st & DJIO_A_P1284_STAT_14)
+			return c;
+	}
+}
+
+static unsigned long get32(void)
+{
+	unsigned long v = getd();
+
+	v = (v << 8) | getd();
+	v = (v << 8) | getd();
+	return (v << 8) | getd();
+}
+
+static unsigned int get16(void)
+{
+	unsigned int v = getd();
+
+	return (v << 8) | getd();
+}
+
+/*
+ * One reverse data byte, once the host turns the bus around for it.
+ * Same steps as dj_p1284_putb(), starting over whenever one times out.
+ */
+static void putd(unsigned char c)
+{
+	int i;
+
+ again:
+	write_cntl(REVERSEREQ_O1);
+	while (read_stat() != REVERSEREQ_I1) { };
+	write_cntl(REVERSEREQ_O2);
+	i = DJ_P1284_SPIN;
+	while (--i) {
+		if (read_stat() == REVERSEREQ_I2) break;
+	}
+	if (!i) goto again;
+	write_cntl(REVERSEREQ_O3);
+	frob_cfg1(DJIO_A_P1284_CTL1_DDRV, DJIO_A_P1284_CTL1_DDRV);
+	P1284_REG(DJIO_A_P1284_DATA) = c;
+	write_cntl(REVERSEREQ_O4);
+	i = DJ_P1284_SPIN;
+	while (--i) {
+		if (read_stat() == REVERSEREQ_I3) break;
+	}
+	if (!i) {
+		frob_cfg1(0, DJIO_A_P1284_CTL1_DDRV);
+		goto again;
+	}
+	write_cntl(REVERSEREQ_O3);
+	i = DJ_P1284_SPIN;
+	while (--i) {
+		if (read_stat() == REVERSEREQ_I2
+		    || read_stat() == REVERSEREQ_I1)
+			break;
+	}
+	frob_cfg1(0, DJIO_A_P1284_CTL1_DDRV);
+	i = DJ_P1284_SPIN;
+	while (--i) {
+		if (read_stat() == REVERSEREQ_I1) break;
+	}
+	write_cntl(REVERSEREQ_O2);
+	i = DJ_P1284_SPIN;
+	while (--i) {}
+	write_cntl(REVERSEREQ_O1);
+}
+
+/***************************************************************************/
+
+void ecpboot_main(void)
+{
+	unsigned long magic, load, entry, size, nblk, crc;
+	unsigned long n, seq, plen, rlen, bcrc, k;
+
+	ecpboot_crc_init(crctab);
+	frob_cfg1(0, DJIO_A_P1284_CTL1_DDRV);
+	write_cntl(REVERSEREQ_O1);
+
+	for (;;) {
+		/* Slide along the stream until a header lines up */
+		for (magic = 0; magic != ECPBOOT_MAGIC; )
+			magic = ((magic << 8) | getd()) & 0xffffffffUL;
+		load = get32();
+		entry = get32();
+		size = get32();
+		nblk = get32();
+		crc = get32();
+		if (load < ECPBOOT_LOAD || load + size > ECPBOOT_BASE ||
+		    nblk != (size + ECPBOOT_BLOCK - 1) / ECPBOOT_BLOCK ||
+		    entry < load || entry >= load + size) {
+			putd(ECPBOOT_FAIL);
+			continue;
+		}
+		putd(ECPBOOT_ACK);
+
+		/*
+		 * A bad CRC gets the block again.  A header that makes no
+		 * sense means we lost our place in the stream, so say
+		 * nothing: the host times out and starts over, and so do we.
+		 */
+		for (n = 0; n < nblk; ) {
+			seq = get32();
+			plen = get16();
+			rlen = get16();
+			bcrc = get32();
+			if (seq != n || plen > sizeof(blk) ||
+			    rlen > ECPBOOT_BLOCK || rlen > size - n * ECPBOOT_BLOCK)
+				break;
+			for (k = 0; k < plen; k++)
+				blk[k] = getd();
+			if (ecpboot_crc(crctab, 0, blk, plen) != bcrc ||
+			    dj_lz_unpack(blk, plen,
+					 (unsigned char *)load + n * ECPBOOT_BLOCK,
+					 rlen) != rlen) {
+				putd(ECPBOOT_NAK);
+				continue;
+			}
+			putd(ECPBOOT_ACK);
+			n++;
+		}
+		if (n < nblk)
+			continue;
+		if (ecpboot_crc(crctab, 0, (unsigned char *)load, size) != crc) {
+			putd(ECPBOOT_FAIL);
+			continue;
+		}
+		putd(ECPBOOT_GO);
+		((void (*)(void))entry)();
+	}
+}
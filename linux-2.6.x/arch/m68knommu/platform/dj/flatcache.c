@@ -0,0 +1,413 @@
+/***************************************************************************/
+
+/*
+ *	dj/flatcache.c -- One relocated text per flat binary, for every exec.
+ *
+ *	Copyright (C) 2010, Brian S. Julin <bri@abrij.org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston MA 02111-1307, USA.
+ *
+ */
+
+/***************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/moduleparam.h>
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/time.h>
+#include <linux/flat.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+#include <asm/dj/flatcache.h>
+
+/* Relocations read per kernel_read() while checking a text */
+#define DJ_FLATCACHE_RELOCS	256
+
+/* Built in as flatcache.o, but asked for as dj_flatcache.max */
+#undef MODULE_PARAM_PREFIX
+#define MODULE_PARAM_PREFIX "dj_flatcache."
+
+static int dj_flatcache_max_kb = DJ_FLATCACHE_MAX_KB;
+module_param_named(max, dj_flatcache_max_kb, int, 0644);
+MODULE_PARM_DESC(max, "KiB of relocated text kept for sharing (0: none)");
+
+struct dj_flat_text {
+	struct list_head list;		/* most recently used first */
+	struct inode *inode;		/* held, and as it was when read */
+	struct timespec mtime;
+	loff_t size;
+	u8 *text;			/* file from 0 to data_start, relocated */
+	unsigned long len;		/* or NULL and 0 if it can't be shared */
+	unsigned long hits;
+	int users;			/* mms running on it, dj_flatcache_users */
+	int stale;			/* file changed since; goes when unused */
+};
+
+/*
+ * One per mm a text was handed to, dropped by dj_flatcache_put() from
+ * destroy_context() when that mm goes.  That can be in atomic context,
+ * hence the spinlock; users only goes up under dj_flatcache_lock too,
+ * so with that held a text seen unused stays unused.
+ */
+struct dj_flat_user {
+	struct list_head list;
+	struct mm_struct *mm;
+	struct dj_flat_text *t;
+};
+
+static LIST_HEAD(dj_flatcache);
+static DEFINE_MUTEX(dj_flatcache_lock);
+static LIST_HEAD(dj_flatcache_users);
+static DEFINE_SPINLOCK(dj_flatcache_users_lock);
+static unsigned long dj_flatcache_bytes;
+static int dj_flatcache_files;
+static unsigned long dj_flatcache_hits, dj_flatcache_misses;
+static unsigned long dj_flatcache_unshareable, dj_flatcache_full;
+
+/***************************************************************************/
+
+/* How many mms are running on this text now */
+static int dj_flat_text_users(struct dj_flat_text *t)
+{
+	int n;
+
+	spin_lock(&dj_flatcache_users_lock);
+	n = t->users;
+	spin_unlock(&dj_flatcache_users_lock);
+	return n;
+}
+
+/* Hold t for the current mm until it is destroyed; 0 if that worked */
+static int dj_flat_text_get(struct dj_flat_text *t)
+{
+	struct dj_flat_user *u;
+
+	u = kmalloc(sizeof(*u), GFP_KERNEL);
+	if (!u)
+		return -ENOMEM;
+	u->mm = current->mm;
+	u->t = t;
+	spin_lock(&dj_flatcache_users_lock);
+	list_add(&u->list, &dj_flatcache_users);
+	t->users++;
+	spin_unlock(&dj_flatcache_users_lock);
+	return 0;
+}
+
+/**
+ * dj_flatcache_put: let go of the texts an mm was running on
+ * @mm: the mm being destroyed
+ *
+ * Called from destroy_context().  The texts themselves stay cached for
+ * the next exec; they are only freed from process context, once unused.
+ */
+void dj_flatcache_put(struct mm_struct *mm)
+{
+	struct dj_flat_user *u, *n;
+
+	spin_lock(&dj_flatcache_users_lock);
+	list_for_each_entry_safe(u, n, &dj_flatcache_users, list) {
+		if (u->mm != mm)
+			continue;
+		u->t->users--;
+		list_del(&u->list);
+		kfree(u);
+	}
+	spin_unlock(&dj_flatcache_users_lock);
+}
+
+static int dj_flat_text_busy(struct dj_flat_text *t)
+{
+	return dj_flat_text_users(t) != 0;
+}
+
+static void dj_flat_text_free(struct dj_flat_text *t)
+{
+	list_del(&t->list);
+	if (t->text) {
+		free_pages_exact(t->text, t->len);
+		dj_flatcache_bytes -= t->len;
+	}
+	dj_flatcache_files--;
+	iput(t->inode);
+	kfree(t);
+}
+
+/*
+ * Free unused entries, least recently used first, until there's room
+ * for len more bytes of text and one more file.  Returns 0 if there is,
+ * with dj_flatcache_lock held.
+ */
+static int dj_flatcache_evict(unsigned long len)
+{
+	struct dj_flat_text *t, *n;
+
+	list_for_each_entry_safe_reverse(t, n, &dj_flatcache, list) {
+		if (dj_flatcache_bytes + len <= dj_flatcache_max_kb * 1024UL &&
+		    dj_flatcache_files < DJ_FLATCACHE_MAX_FILES)
+			break;
+		if (!dj_flat_text_busy(t))
+			dj_flat_text_free(t);
+	}
+	return dj_flatcache_bytes + len <= dj_flatcache_max_kb * 1024UL &&
+		dj_flatcache_files < DJ_FLATCACHE_MAX_FILES ? 0 : -ENOMEM;
+}
+
+/***************************************************************************/
+
+/*
+ * Read the text and do the relocations that land in it, as
+ * binfmt_flat's calc_reloc() would for a text at t->text.  Any of them
+ * pointing past the text, into data, means it can't be shared; that
+ * leaves t->text NULL, and the file gets loaded the usual way from then
+ * on without being looked at again.
+ */
+static int dj_flat_text_load(struct dj_flat_text *t, struct file *file,
+			     struct flat_hdr *hdr)
+{
+	unsigned long flags = ntohl(hdr->flags);
+	unsigned long text_len = ntohl(hdr->data_start);
+	unsigned long reloc_start = ntohl(hdr->reloc_start);
+	unsigned long relocs = ntohl(hdr->reloc_count);
+	unsigned long start, i, j, n;
+	unsigned long *buf;
+	u8 *text;
+	int ret = -ENOEXEC;
+
+	if (text_len <= sizeof(struct flat_hdr))
+		return 0;
+	if (dj_flatcache_evict(text_len)) {
+		dj_flatcache_full++;
+		return -ENOMEM;
+	}
+	text = alloc_pages_exact(text_len, GFP_KERNEL);
+	buf = kmalloc(DJ_FLATCACHE_RELOCS * sizeof(*buf), GFP_KERNEL);
+	if (!text || !buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (kernel_read(file, 0, text, text_len) != text_len)
+		goto out;
+
+	start = (unsigned long) text + sizeof(struct flat_hdr);
+	for (i = 0; i < relocs; i += n) {
+		n = min(relocs - i, (unsigned long) DJ_FLATCACHE_RELOCS);
+		if (kernel_read(file, reloc_start + i * sizeof(*buf),
+				(char *) buf, n * sizeof(*buf)) !=
+		    n * sizeof(*buf))
+			goto out;
+		for (j = 0; j < n; j++) {
+			unsigned long relval = ntohl(buf[j]);
+			unsigned long addr = flat_get_relocate_addr(relval);
+			unsigned long *rp;
+
+			/* In data, so every process's own to do */
+			if (addr >= text_len)
+				continue;
+			if (addr + sizeof(struct flat_hdr) + sizeof(*rp) >
+			    text_len)
+				goto unshareable;
+			rp = (unsigned long *) (start + addr);
+			addr = flat_get_addr_from_rp(rp, relval, flags, NULL);
+			if (!addr)
+				continue;
+			if ((flags & FLAT_FLAG_GOTPIC) == 0)
+				addr = ntohl(addr);
+			if (addr >= text_len)
+				goto unshareable;
+			flat_put_addr_at_rp(rp, start + addr, relval);
+		}
+	}
+	t->text = text;
+	t->len = text_len;
+	dj_flatcache_bytes += text_len;
+	text = NULL;
+	ret = 0;
+	goto out;
+
+unshareable:
+	dj_flatcache_unshareable++;
+	ret = 0;
+out:
+	kfree(buf);
+	if (text)
+		free_pages_exact(text, text_len);
+	return ret;
+}
+
+/**
+ * dj_flatcache_text: a shared, relocated text for a flat binary
+ * @file: the binary being exec'd
+ * @hdr: its header
+ *
+ * Only for version 4 FLAT_FLAG_RAM binaries with nothing compressed;
+ * anything else binfmt_flat already maps straight from the file, or
+ * has to inflate, and a GZDATA one would have its data inflated by the
+ * ROM path's code that it gets sent down on a hit.  The text is held
+ * for current->mm, which binfmt_flat has already swapped in by now,
+ * until that mm is destroyed.  Returns where byte 0 of the file is in
+ * the text, or 0 for binfmt_flat to load it itself.
+ */
+unsigned long dj_flatcache_text(struct file *file, struct flat_hdr *hdr)
+{
+	struct inode *inode = file->f_path.dentry->d_inode;
+	unsigned long flags = ntohl(hdr->flags);
+	struct dj_flat_text *t, *n;
+	unsigned long textpos = 0;
+
+	if (ntohl(hdr->rev) != FLAT_VERSION ||
+	    (flags & (FLAT_FLAG_RAM | FLAT_FLAG_GZIP | FLAT_FLAG_GZDATA)) !=
+	    FLAT_FLAG_RAM || dj_flatcache_max_kb <= 0)
+		return 0;
+
+	mutex_lock(&dj_flatcache_lock);
+	list_for_each_entry_safe(t, n, &dj_flatcache, list) {
+		/* Whatever was run from an old version has finished now */
+		if (t->stale && !dj_flat_text_busy(t)) {
+			dj_flat_text_free(t);
+			continue;
+		}
+		if (t->inode != inode || t->stale)
+			continue;
+		if (!timespec_equal(&t->mtime, &inode->i_mtime) ||
+		    t->size != i_size_read(inode)) {
+			t->stale = 1;
+			if (!dj_flat_text_busy(t))
+				dj_flat_text_free(t);
+			break;
+		}
+		list_move(&t->list, &dj_flatcache);
+		if (t->text && !dj_flat_text_get(t)) {
+			t->hits++;
+			dj_flatcache_hits++;
+			textpos = (unsigned long) t->text;
+		}
+		goto out;
+	}
+
+	dj_flatcache_misses++;
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		goto out;
+	t->inode = igrab(inode);
+	t->mtime = inode->i_mtime;
+	t->size = i_size_read(inode);
+	if (!t->inode || dj_flat_text_load(t, file, hdr)) {
+		if (t->inode)
+			iput(t->inode);
+		kfree(t);
+		goto out;
+	}
+	list_add(&t->list, &dj_flatcache);
+	dj_flatcache_files++;
+	if (t->text && !dj_flat_text_get(t))
+		textpos = (unsigned long) t->text;
+out:
+	mutex_unlock(&dj_flatcache_lock);
+	return textpos;
+}
+
+/***************************************************************************/
+
+/* Give back whatever texts nobody is running when memory gets short */
+
+static int dj_flatcache_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct dj_flat_text *t, *n;
+	int left = 0;
+
+	if (!mutex_trylock(&dj_flatcache_lock))
+		return nr_to_scan ? -1 : 0;
+	list_for_each_entry_safe_reverse(t, n, &dj_flatcache, list) {
+		if (!t->text)
+			continue;
+		if (nr_to_scan > 0 && !dj_flat_text_busy(t)) {
+			dj_flat_text_free(t);
+			nr_to_scan--;
+		} else
+			left++;
+	}
+	mutex_unlock(&dj_flatcache_lock);
+	return left;
+}
+
+static struct shrinker dj_flatcache_shrinker = {
+	.shrink		= dj_flatcache_shrink,
+	.seeks		= DEFAULT_SEEKS,
+};
+
+/***************************************************************************/
+
+/*
+ * /proc/dj_flatcache: totals, then each file with how many processes
+ * (mms) are running on its text; each one past the first is len bytes
+ * that didn't have to be read, relocated or allocated.
+ */
+
+static int dj_flatcache_show(struct seq_file *m, void *v)
+{
+	struct dj_flat_text *t;
+	unsigned long saved = 0;
+	int users;
+
+	mutex_lock(&dj_flatcache_lock);
+	seq_printf(m, "hits %lu misses %lu unshareable %lu full %lu\n",
+		   dj_flatcache_hits, dj_flatcache_misses,
+		   dj_flatcache_unshareable, dj_flatcache_full);
+	seq_printf(m, "%10s %8s %6s %8s\n", "inode", "bytes", "users", "hits");
+	list_for_each_entry(t, &dj_flatcache, list) {
+		users = dj_flat_text_users(t);
+		if (users > 1)
+			saved += (users - 1) * t->len;
+		seq_printf(m, "%10lu %8lu %6d %8lu%s%s\n", t->inode->i_ino,
+			   t->len, users, t->hits, t->text ? "" : " unshared",
+			   t->stale ? " stale" : "");
+	}
+	seq_printf(m, "%lu bytes cached in %d files, %lu bytes saved now\n",
+		   dj_flatcache_bytes, dj_flatcache_files, saved);
+	mutex_unlock(&dj_flatcache_lock);
+	return 0;
+}
+
+static int dj_flatcache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dj_flatcache_show, NULL);
+}
+
+static const struct file_operations dj_flatcache_fops = {
+	.open		= dj_flatcache_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init dj_flatcache_init(void)
+{
+	register_shrinker(&dj_flatcache_shrinker);
+	proc_create("dj_flatcache", 0444, NULL, &dj_flatcache_fops);
+	return 0;
+}
+
+device_initcall(dj_flatcache_init);
+
+/***************************************************************************/
@@ -18,10 +18,21 @@
 #include <linux/interrupt.h>
 #include <linux/irq.h>
 #include <linux/io.h>
+#include <linux/kernel_stat.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/random.h>
+#include <linux/string.h>
+#include <asm/uaccess.h>
 #include <asm/traps.h>
 #include <asm/machdep.h>
 #include <asm/dj/djio.h>
 #include <asm/dj/irq.h>
+#include <asm/dj/timer.h>
+#include <asm/dj/kine.h>
+#include <asm/dj/usb.h>
 
 /* assembler routines */
 asmlinkage void system_call(void);
@@ -69,53 +80,831 @@ void init_vectors(void)
 
 char *foo[200];
 
-void enable_vector(unsigned int irq)
+/*
+ * The controller has a byte per line: the priority in the low bits, 0
+ * for off, and a latch in bit 7 that any write with it clear acks.  So
+ * every operation is one byte written to one line.  The old
+ * enable/disable/ack_vector() wrapped each in a write either side to
+ * DJIO_A_IRQ_GLOBAL, and ack wrote 0, leaving the line off until the
+ * driver put the priority back itself.  genirq calls all of these with
+ * the CPU's interrupts off and desc->lock held, so there's nothing for
+ * the global bit to protect.
+ *
+ * dj_irq_shadow[] is what each register was last written with, so
+ * nothing is read back over the bus and a mask or unmask that would
+ * change nothing costs no bus cycle at all.  dj_irq_prio[] is what an
+ * unmask puts back.
+ */
+static u8 dj_irq_shadow[DJIO_A_IRQ_NLINES];
+static u8 dj_irq_prio[DJIO_A_IRQ_NLINES];
+
+/*
+ * The controller raises each line at the CPU level of its priority,
+ * but entry.S's SAVE_ALL goes to 7 while it changes stacks, and the
+ * flow handler keeps it there while it masks, acks and does the
+ * bookkeeping.  Only for the handlers themselves does
+ * dj_handle_level_irq() drop to the SR here, and only for lines whose
+ * handlers aren't IRQF_DISABLED: then a line above can come in over
+ * them, and lines at their level or below wait.  Vectors that aren't
+ * the ASIC's stay at 7.
+ */
+static unsigned short dj_vector_sr[256] = {
+	[0 ... 255] = 0x2700,
+};
+
+/*
+ * The DJ895C's lines by what they are; anything not here gets
+ * DJ_IRQ_PRIO_DEFAULT.  Motion has to be served within a few encoder
+ * counts and the tick shouldn't slip behind a USB pass, so both go
+ * above USB, motion higher still.
+ */
+static u8 dj_irq_prio_map[DJIO_A_IRQ_NLINES] __initdata = {
+	[DJIO_A_KINE_STP0_IRQ_LINE]	= DJ_IRQ_PRIO_MOTION,
+	[DJIO_A_KINE_BDC0_IRQ_LINE]	= DJ_IRQ_PRIO_MOTION,	/* and ENC0 */
+	[DJIO_A_KINE_BDC1_IRQ_LINE]	= DJ_IRQ_PRIO_MOTION,
+	[DJIO_A_TIMER_IRQ_A_LINE]	= DJ_IRQ_PRIO_TIMER,
+	[DJIO_A_TIMER_IRQ_B_LINE]	= DJ_IRQ_PRIO_TIMER,
+	[DJIO_A_TIMER_IRQ_C_LINE]	= DJ_IRQ_PRIO_TIMER,
+	[DJIO_A_TIMER_IRQ_D_LINE]	= DJ_IRQ_PRIO_TIMER,
+	[DJIO_A_TIMER_IRQ_E_LINE]	= DJ_IRQ_PRIO_TIMER,
+	[DJIO_A_USB_IRQA_LINE]		= DJ_IRQ_PRIO_DEFAULT,
+};
+
+/* From "dj_irq_prio=line:prio,..." on the command line, 0 for none */
+static u8 dj_irq_prio_cmdline[DJIO_A_IRQ_NLINES] __initdata;
+
+static inline void dj_irq_write(unsigned int n, u8 val)
+{
+	dj_irq_shadow[n] = val;
+	writeb(val, DJIO_A_IRQ_N(n));
+}
+
+static void dj_irq_mask(unsigned int irq)
+{
+	unsigned int n = irq - DJIO_IRQ_BASE;
+
+	if (dj_irq_shadow[n] != DJIO_A_IRQ_IRQN_DISABLE)
+		dj_irq_write(n, DJIO_A_IRQ_IRQN_DISABLE);
+}
+
+static void dj_irq_unmask(unsigned int irq)
+{
+	unsigned int n = irq - DJIO_IRQ_BASE;
+
+	if (dj_irq_shadow[n] != dj_irq_prio[n])
+		dj_irq_write(n, dj_irq_prio[n]);
+}
+
+/* Acks without touching the priority; also the eoi */
+static void dj_irq_ack(unsigned int irq)
+{
+	unsigned int n = irq - DJIO_IRQ_BASE;
+
+	writeb(dj_irq_shadow[n], DJIO_A_IRQ_N(n));
+}
+
+/* Writing 0 does both at once */
+static void dj_irq_mask_ack(unsigned int irq)
+{
+	dj_irq_write(irq - DJIO_IRQ_BASE, DJIO_A_IRQ_IRQN_DISABLE);
+}
+
+static struct irq_chip dj_irq_chip = {
+	.name		= "DJ-ASIC",
+	.mask		= dj_irq_mask,
+	.unmask		= dj_irq_unmask,
+	.ack		= dj_irq_ack,
+	.mask_ack	= dj_irq_mask_ack,
+	.eoi		= dj_irq_ack,
+};
+
+static inline void dj_irq_set_level(unsigned int n, u8 prio)
 {
+	dj_irq_prio[n] = prio;
+	dj_vector_sr[DJIO_IRQ_BASE + n] = 0x2000 | (prio << 8);
+}
+
+/**
+ * dj_irq_set_prio: give an ASIC line a new priority
+ * @irq: the line's irq (vector) number
+ * @prio: 1 to DJ_IRQ_PRIO_MAX
+ *
+ * Takes effect at once if the line is unmasked, or at its next unmask.
+ * One that is already in its handler finishes at the old level.
+ */
+int dj_irq_set_prio(unsigned int irq, unsigned int prio)
+{
+	unsigned int n = irq - DJIO_IRQ_BASE;
 	unsigned long flags;
 
-	if (irq < DJIO_IRQ_BASE)
-		return;
-	if (irq > DJIO_IRQ_BASE + 0x1f)
-		return; /* 0x1f is a guess */
+	if (irq < DJIO_IRQ_BASE || n >= DJIO_A_IRQ_NLINES ||
+	    prio < 1 || prio > DJ_IRQ_PRIO_MAX)
+		return -EINVAL;
 
 	local_irq_save(flags);
-	outb(DJIO_A_IRQ_GLOBAL_DISABLE, DJIO_A_IRQ_GLOBAL);
-	outb(2, DJIO_A_IRQ_N(irq - DJIO_IRQ_BASE)); /* All are prio 2 for now */
-	outb(DJIO_A_IRQ_GLOBAL_ENABLE, DJIO_A_IRQ_GLOBAL);
+	dj_irq_set_level(n, prio);
+	if (dj_irq_shadow[n] != DJIO_A_IRQ_IRQN_DISABLE)
+		dj_irq_write(n, prio);
 	local_irq_restore(flags);
+	return 0;
 }
+EXPORT_SYMBOL(dj_irq_set_prio);
 
-void disable_vector(unsigned int irq)
+/**
+ * dj_irq_get_prio: an ASIC line's priority
+ * @irq: the line's irq (vector) number
+ *
+ * What it runs at when unmasked, whether it is now or not, for putting
+ * back after a dj_irq_set_prio().
+ */
+int dj_irq_get_prio(unsigned int irq)
+{
+	unsigned int n = irq - DJIO_IRQ_BASE;
+
+	if (irq < DJIO_IRQ_BASE || n >= DJIO_A_IRQ_NLINES)
+		return -EINVAL;
+	return dj_irq_prio[n];
+}
+EXPORT_SYMBOL(dj_irq_get_prio);
+
+static int __init dj_irq_prio_setup(char *str)
+{
+	unsigned long n, prio;
+	char *p = str;
+
+	while (*p) {
+		n = simple_strtoul(p, &p, 0);
+		if (*p++ != ':')
+			break;
+		prio = simple_strtoul(p, &p, 0);
+		if (n < DJIO_A_IRQ_NLINES && prio >= 1 &&
+		    prio <= DJ_IRQ_PRIO_MAX)
+			dj_irq_prio_cmdline[n] = prio;
+		else
+			printk(KERN_WARNING "dj_irq_prio: no line %#lx "
+			       "at %lu\n", n, prio);
+		if (*p != ',')
+			break;
+		p++;
+	}
+	return 1;
+}
+__setup("dj_irq_prio=", dj_irq_prio_setup);
+
+/* kernel/irq/spurious.c's, which only kernel/irq/internals.h declares */
+extern int noirqdebug;
+
+/* handle_IRQ_event(), but down to the line's level rather than to 0 */
+static irqreturn_t dj_irq_handle_actions(unsigned int irq,
+					 struct irqaction *action)
+{
+	irqreturn_t ret, retval = IRQ_NONE;
+	unsigned int status = 0;
+
+	if (!(action->flags & IRQF_DISABLED))
+		local_irq_restore(dj_vector_sr[irq]);
+	do {
+		ret = action->handler(irq, action->dev_id);
+		if (ret == IRQ_HANDLED)
+			status |= action->flags;
+		retval |= ret;
+		action = action->next;
+	} while (action);
+	if (status & IRQF_SAMPLE_RANDOM)
+		add_interrupt_randomness(irq);
+	local_irq_disable();
+	return retval;
+}
+
+/*
+ * handle_level_irq(), with dj_irq_handle_actions() for the handlers.
+ * The line is masked and acked at 7 first, so while its handlers run
+ * only the lines above can come in; the same line again waits for the
+ * unmask, as do those at its level or below for the SR.
+ */
+static void dj_handle_level_irq(unsigned int irq, struct irq_desc *desc)
+{
+	struct irqaction *action;
+	irqreturn_t ret;
+
+	spin_lock(&desc->lock);
+	desc->chip->mask_ack(irq);
+	if (unlikely(desc->status & IRQ_INPROGRESS))
+		goto out_unlock;
+	desc->status &= ~(IRQ_REPLAY | IRQ_WAITING);
+	kstat_incr_irqs_this_cpu(irq, desc);
+
+	action = desc->action;
+	if (unlikely(!action || (desc->status & IRQ_DISABLED)))
+		goto out_unlock;
+	desc->status |= IRQ_INPROGRESS;
+	spin_unlock(&desc->lock);
+
+	ret = dj_irq_handle_actions(irq, action);
+	if (!noirqdebug)
+		note_interrupt(irq, desc, ret);
+
+	spin_lock(&desc->lock);
+	desc->status &= ~IRQ_INPROGRESS;
+	if (!(desc->status & IRQ_DISABLED))
+		desc->chip->unmask(irq);
+out_unlock:
+	spin_unlock(&desc->lock);
+}
+
+/*
+ * Lines start off level flow: masked and acked in one write on the way
+ * in, unmasked on the way out, which is right whatever the handler does
+ * with the CPU's interrupts meanwhile.  A line whose handler runs
+ * IRQF_DISABLED and quiets its source before returning can go to
+ * handle_fasteoi_irq with set_irq_handler() before it's set up, and
+ * then costs just the one write after the handler (timer.c does).
+ *
+ * Vectors outside the ASIC's lines keep handle_bad_irq.  The rest of
+ * arch/m68knommu/kernel/irq.c's init_IRQ() and __do_IRQ() is left to
+ * the other platforms.
+ */
+void __init init_IRQ(void)
+{
+	unsigned int n;
+
+	init_vectors();
+	for (n = 0; n < DJIO_A_IRQ_NLINES; n++) {
+		if (dj_irq_prio_cmdline[n])
+			dj_irq_set_level(n, dj_irq_prio_cmdline[n]);
+		else if (dj_irq_prio_map[n])
+			dj_irq_set_level(n, dj_irq_prio_map[n]);
+		else
+			dj_irq_set_level(n, DJ_IRQ_PRIO_DEFAULT);
+		dj_irq_write(n, DJIO_A_IRQ_IRQN_DISABLE);
+		set_irq_chip_and_handler(DJIO_IRQ_BASE + n, &dj_irq_chip,
+					 dj_handle_level_irq);
+	}
+	writeb(DJIO_A_IRQ_GLOBAL_ENABLE, DJIO_A_IRQ_GLOBAL);
+}
+
+/*
+ * Every line off and acked, for handing the machine to another kernel
+ * (platform/dj/reload.c).  That one's init_IRQ() starts them all off
+ * again and turns them on as it needs them, just as it would from the
+ * ROM.
+ */
+void dj_irq_quiesce(void)
 {
 	unsigned long flags;
+	unsigned int n;
 
-	if (irq < DJIO_IRQ_BASE)
-		return;
-	if (irq > DJIO_IRQ_BASE + 0x1f)
-		return; /* 0x1f is a guess */
+	local_irq_save(flags);
+	for (n = 0; n < DJIO_A_IRQ_NLINES; n++)
+		dj_irq_write(n, DJIO_A_IRQ_IRQN_DISABLE);
+	local_irq_restore(flags);
+}
+
+/***************************************************************************/
+
+/*
+ * Fast interrupts (see asm/dj/irq.h).  fastirq.S's dj_fast_entry finds
+ * its line's entry here from the vector; it knows the layout, so keep
+ * the two in step.
+ */
+struct dj_fast_line {
+	dj_fast_handler_t handler;
+	void *dev;
+	volatile u8 *reg;	/* the line's register, for the eoi */
+	u8 *shadow;		/* and what to write to it */
+};
+
+struct dj_fast_line dj_fast_lines[DJIO_A_IRQ_NLINES];
+static const char *dj_fast_names[DJIO_A_IRQ_NLINES];
+
+asmlinkage void dj_fast_entry(void);
+
+/*
+ * Tasklets deferred by fast handlers since the last way out through
+ * dj_fast_slowpath.  fastirq.S looks at dj_fast_ndeferred, so a fast
+ * interrupt that leaves nothing costs no more than the test.
+ */
+#define DJ_FAST_DEFER_MAX	8
+
+static struct tasklet_struct *dj_fast_deferred[DJ_FAST_DEFER_MAX];
+unsigned long dj_fast_ndeferred;
+static unsigned long dj_fast_dropped;
+
+/**
+ * dj_fast_irq_request: hand an ASIC line to a fast handler
+ * @irq: the line's irq (vector) number
+ * @handler: called with @dev at the line's level
+ * @dev: anything
+ * @name: for /proc/dj_irq
+ *
+ * The line's vector goes straight to dj_fast_entry, and the line is
+ * unmasked at its priority.  It can't be request_irq()ed meanwhile.
+ */
+int dj_fast_irq_request(unsigned int irq, dj_fast_handler_t handler,
+			void *dev, const char *name)
+{
+	unsigned int n = irq - DJIO_IRQ_BASE;
+	struct dj_fast_line *fl;
+	struct irq_desc *desc;
+	unsigned long flags;
 
+	if (irq < DJIO_IRQ_BASE || n >= DJIO_A_IRQ_NLINES || !handler)
+		return -EINVAL;
+
+	fl = &dj_fast_lines[n];
+	desc = irq_to_desc(irq);
 	local_irq_save(flags);
-	outb(DJIO_A_IRQ_GLOBAL_DISABLE, DJIO_A_IRQ_GLOBAL);
-	outb(DJIO_A_IRQ_IRQN_DISABLE, DJIO_A_IRQ_N(irq - DJIO_IRQ_BASE));
-	outb(DJIO_A_IRQ_GLOBAL_ENABLE, DJIO_A_IRQ_GLOBAL);
+	if (desc->action || fl->handler) {
+		local_irq_restore(flags);
+		return -EBUSY;
+	}
+	desc->status |= IRQ_NOREQUEST;
+	fl->handler = handler;
+	fl->dev = dev;
+	fl->reg = (volatile u8 *)DJIO_A_IRQ_N(n);
+	fl->shadow = &dj_irq_shadow[n];
+	dj_fast_names[n] = name;
+	_ramvec[irq] = dj_fast_entry;
+	dj_irq_unmask(irq);
 	local_irq_restore(flags);
+	return 0;
 }
+EXPORT_SYMBOL(dj_fast_irq_request);
 
-void ack_vector(unsigned int irq)
+/**
+ * dj_fast_irq_free: give a line back to inthandler and genirq, masked
+ * @irq: the line's irq (vector) number
+ */
+void dj_fast_irq_free(unsigned int irq)
 {
+	unsigned int n = irq - DJIO_IRQ_BASE;
 	unsigned long flags;
 
-	if (irq < DJIO_IRQ_BASE)
+	if (irq < DJIO_IRQ_BASE || n >= DJIO_A_IRQ_NLINES ||
+	    !dj_fast_lines[n].handler)
 		return;
-	if (irq > DJIO_IRQ_BASE + 0x1f)
-		return; /* 0x1f is a guess */
+
+	local_irq_save(flags);
+	dj_irq_mask(irq);
+	_ramvec[irq] = inthandler;
+	memset(&dj_fast_lines[n], 0, sizeof(dj_fast_lines[n]));
+	dj_fast_names[n] = NULL;
+	irq_to_desc(irq)->status &= ~IRQ_NOREQUEST;
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(dj_fast_irq_free);
+
+/**
+ * dj_fast_irq_defer: have a tasklet scheduled once this fast interrupt
+ * is on its way out
+ * @t: the tasklet
+ *
+ * Only for fast handlers; anywhere else, tasklet_hi_schedule() it.
+ * This touches nothing but the list, and fastirq.S then leaves through
+ * dj_fast_slowpath, which schedules the list from a proper interrupt
+ * context and runs it at irq_exit().
+ */
+void dj_fast_irq_defer(struct tasklet_struct *t)
+{
+	unsigned long flags, i;
+
+	local_irq_save(flags);
+	for (i = 0; i < dj_fast_ndeferred; i++)
+		if (dj_fast_deferred[i] == t)
+			goto out;
+	if (dj_fast_ndeferred < DJ_FAST_DEFER_MAX)
+		dj_fast_deferred[dj_fast_ndeferred++] = t;
+	else
+		dj_fast_dropped++;
+out:
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(dj_fast_irq_defer);
+
+/* From entry.S's dj_fast_slowpath, at 7 */
+asmlinkage void dj_fast_irq_tail(struct pt_regs *regs)
+{
+	struct pt_regs *oldregs = set_irq_regs(regs);
+	unsigned long i;
+
+	irq_enter();
+	for (i = 0; i < dj_fast_ndeferred; i++)
+		tasklet_hi_schedule(dj_fast_deferred[i]);
+	dj_fast_ndeferred = 0;
+	irq_exit();
+	set_irq_regs(oldregs);
+}
+
+#ifdef CONFIG_DJ_IRQ_OVERHEAD
+
+/*
+ * What getting to a handler costs, timed once at boot off the ASIC's
+ * free running counter and printed.  Timer B's line is used, as nothing
+ * starts timer B; generic_handle_irq() is called on it directly, so
+ * this is do_IRQ()'s part of the way in, everything but entry.S.
+ * Alongside, the controller operations themselves, and the old
+ * ack_vector() and the re-arm drivers did after it, for comparison.
+ * All averages over DJ_IRQ_OH_RUNS, in ns.
+ */
+#define DJ_IRQ_OH_RUNS	64
+#define DJ_IRQ_OH_IRQ	(DJIO_IRQ_BASE + DJIO_A_TIMER_IRQ_B_LINE)
+
+static unsigned long dj_irq_oh_stamp;
+
+static inline unsigned long dj_irq_oh_now(void)
+{
+	return readl(DJIO_A_TIMER + DJIO_A_TIMER_COUNTER);
+}
+
+/* Counter clicks to ns, for a sum over DJ_IRQ_OH_RUNS */
+static unsigned long dj_irq_oh_ns(unsigned long clicks)
+{
+	return clicks * CONFIG_DJ_COUNTER_DIV * 1000 / 16 / DJ_IRQ_OH_RUNS;
+}
+
+static irqreturn_t dj_irq_oh_handler(int irq, void *dummy)
+{
+	dj_irq_oh_stamp = dj_irq_oh_now();
+	return IRQ_HANDLED;
+}
+
+static void dj_irq_oh_nothing(unsigned int irq)
+{
+}
+
+/* ack_vector() as it was, and what dj_timer_tick() did after it */
+static void dj_irq_oh_old(unsigned int irq)
+{
+	unsigned long flags;
+
 	local_irq_save(flags);
-	outb(DJIO_A_IRQ_GLOBAL_DISABLE, DJIO_A_IRQ_GLOBAL);
-	outb(0, DJIO_A_IRQ_N(irq - DJIO_IRQ_BASE)); /* XXX prio is stomped */
-	outb(DJIO_A_IRQ_GLOBAL_ENABLE, DJIO_A_IRQ_GLOBAL);
+	writeb(DJIO_A_IRQ_GLOBAL_DISABLE, DJIO_A_IRQ_GLOBAL);
+	writeb(0, DJIO_A_IRQ_N(irq - DJIO_IRQ_BASE));
+	writeb(DJIO_A_IRQ_GLOBAL_ENABLE, DJIO_A_IRQ_GLOBAL);
 	local_irq_restore(flags);
+
+	writeb(DJIO_A_IRQ_GLOBAL_DISABLE, DJIO_A_IRQ_GLOBAL);
+	writeb(DJ_IRQ_PRIO_DEFAULT, DJIO_A_IRQ_N(irq - DJIO_IRQ_BASE));
+	writeb(DJIO_A_IRQ_GLOBAL_ENABLE, DJIO_A_IRQ_GLOBAL);
+}
+
+static void dj_irq_oh_level(unsigned int irq)
+{
+	dj_irq_mask_ack(irq);
+	dj_irq_unmask(irq);
+}
+
+static unsigned long dj_irq_oh_op(void (*op)(unsigned int irq))
+{
+	unsigned long t;
+	int i;
+
+	t = dj_irq_oh_now();
+	for (i = 0; i < DJ_IRQ_OH_RUNS; i++)
+		op(DJ_IRQ_OH_IRQ);
+	return dj_irq_oh_now() - t;
 }
 
+/* Sums of clicks to the handler, and all the way through */
+static void dj_irq_oh_dispatch(unsigned long *in, unsigned long *through)
+{
+	unsigned long t;
+	int i;
+
+	*in = *through = 0;
+	for (i = 0; i < DJ_IRQ_OH_RUNS; i++) {
+		t = dj_irq_oh_now();
+		generic_handle_irq(DJ_IRQ_OH_IRQ);
+		*through += dj_irq_oh_now() - t;
+		*in += dj_irq_oh_stamp - t;
+	}
+}
+
+static struct irqaction dj_irq_oh_action = {
+	.name		= "irq-overhead",
+	.flags		= IRQF_DISABLED,
+	.handler	= dj_irq_oh_handler,
+};
+
+static int __init dj_irq_overhead(void)
+{
+	unsigned long flags, loop, old, level, eoi, lin, lthru, fin, fthru;
+
+	writew(DJIO_A_TIMER_IRQ_B, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ACK);
+	if (setup_irq(DJ_IRQ_OH_IRQ, &dj_irq_oh_action))
+		return 0;
+
+	local_irq_save(flags);
+	loop = dj_irq_oh_op(dj_irq_oh_nothing);
+	old = dj_irq_oh_op(dj_irq_oh_old) - loop;
+	level = dj_irq_oh_op(dj_irq_oh_level) - loop;
+	eoi = dj_irq_oh_op(dj_irq_ack) - loop;
+	dj_irq_oh_dispatch(&lin, &lthru);
+	set_irq_handler(DJ_IRQ_OH_IRQ, handle_fasteoi_irq);
+	dj_irq_oh_dispatch(&fin, &fthru);
+	set_irq_handler(DJ_IRQ_OH_IRQ, dj_handle_level_irq);
+	local_irq_restore(flags);
+
+	remove_irq(DJ_IRQ_OH_IRQ, &dj_irq_oh_action);
+
+	printk(KERN_INFO "dj: irq: old ack+re-arm %lu ns, mask_ack+unmask "
+	       "%lu ns, eoi %lu ns\n", dj_irq_oh_ns(old), dj_irq_oh_ns(level),
+	       dj_irq_oh_ns(eoi));
+	printk(KERN_INFO "dj: irq: do_IRQ to handler %lu ns level, %lu ns "
+	       "fasteoi; and out %lu ns, %lu ns\n", dj_irq_oh_ns(lin),
+	       dj_irq_oh_ns(fin), dj_irq_oh_ns(lthru), dj_irq_oh_ns(fthru));
+	return 0;
+}
+late_initcall(dj_irq_overhead);
+
+/*
+ * Latency by level, run by writing "test" to /proc/dj_irq.  Timer B
+ * fires DJ_IRQ_LAT_SHOTS one-shots with its line at each priority in
+ * turn, the motion level standing in for the motor and encoder lines
+ * (which can't be made to fire without moving something), and the
+ * counter at handler entry less when the shot was due is kept.  Keep
+ * USB busy meanwhile, a host writing flat out to the gadget's serial
+ * port say: above USB's level the worst case should stay near the
+ * best, while at USB's own it grows to a whole djcf_udc_irq pass.
+ *
+ * The last pass is at the motion level again through fastirq.S, so
+ * the difference from the first is what inthandler, do_IRQ() and
+ * genirq cost on the way in.  A fast handler has to hand the wakeup to
+ * a tasklet, so the genirq one does the same: every pass ends its
+ * shots the same way, and nothing that takes the wait queue's lock
+ * runs from inside the interrupt.
+ */
+#define DJ_IRQ_LAT_SHOTS	200
+#define DJ_IRQ_LAT_IRQ		DJ_IRQ_OH_IRQ
+
+struct dj_irq_lat {
+	unsigned int prio, fast, shots, in_usb;
+	unsigned long min, max, sum;
+};
+
+static const struct {
+	u8 prio, fast;
+} dj_irq_lat_passes[] = {
+	{ DJ_IRQ_PRIO_MOTION, 0 },
+	{ DJ_IRQ_PRIO_TIMER, 0 },
+	{ DJ_IRQ_PRIO_DEFAULT, 0 },
+	{ DJ_IRQ_PRIO_MOTION, 1 },
+};
+
+static struct dj_irq_lat dj_irq_lat[ARRAY_SIZE(dj_irq_lat_passes)];
+static struct dj_irq_lat *dj_irq_lat_cur;
+static unsigned long dj_irq_lat_due;
+static DECLARE_COMPLETION(dj_irq_lat_done);
+static DEFINE_MUTEX(dj_irq_lat_mutex);
+
+/* Nothing here may touch current: it's the fast handler's too */
+static void dj_irq_lat_record(void)
+{
+	struct dj_irq_lat *l = dj_irq_lat_cur;
+	unsigned long d = dj_irq_oh_now() - dj_irq_lat_due;
+
+	writew(DJIO_A_TIMER_IRQ_B, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ACK);
+	if ((long)d < 0)
+		d = 0;
+	if (d < l->min)
+		l->min = d;
+	if (d > l->max)
+		l->max = d;
+	l->sum += d;
+	l->shots++;
+	if (irq_to_desc(DJIO_IRQ_BASE + DJIO_A_USB_IRQA_LINE)->status &
+	    IRQ_INPROGRESS)
+		l->in_usb++;
+}
+
+static void dj_irq_lat_done_fn(unsigned long data)
+{
+	complete(&dj_irq_lat_done);
+}
+
+static DECLARE_TASKLET(dj_irq_lat_tasklet, dj_irq_lat_done_fn, 0);
+
+static irqreturn_t dj_irq_lat_handler(int irq, void *dummy)
+{
+	dj_irq_lat_record();
+	tasklet_hi_schedule(&dj_irq_lat_tasklet);
+	return IRQ_HANDLED;
+}
+
+static void dj_irq_lat_fast(void *dummy)
+{
+	dj_irq_lat_record();
+	dj_fast_irq_defer(&dj_irq_lat_tasklet);
+}
+
+/* Timer B's source on or off, as timer.c's dj_timer_frob_enab() */
+static void dj_irq_lat_enab(int enab)
+{
+	unsigned long flags;
+	u16 tmp;
+
+	local_irq_save(flags);
+	tmp = readw(DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ENAB);
+	if (enab)
+		tmp |= DJIO_A_TIMER_IRQ_B;
+	else
+		tmp &= ~DJIO_A_TIMER_IRQ_B;
+	writew(tmp, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ENAB);
+	local_irq_restore(flags);
+}
+
+/* 250 to 500 us, spread so the shots don't lock to USB's frames */
+static void dj_irq_lat_shot(int i)
+{
+	unsigned long base = DJ_COUNTER_FREQ / 4000, flags;
+	unsigned long delta = base + (i * 7919) % base;
+
+	local_irq_save(flags);
+	writew(DJIO_A_TIMER_IRQ_B, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ACK);
+	dj_irq_lat_due = dj_irq_oh_now() + delta + DJ_TIMER_LAG_CLICKS;
+	writew(delta, DJIO_A_TIMER + DJIO_A_TIMER_B_SHOT);
+	local_irq_restore(flags);
+}
+
+static int dj_irq_lat_pass(struct dj_irq_lat *l)
+{
+	int i, ret;
+
+	if (l->fast)
+		ret = dj_fast_irq_request(DJ_IRQ_LAT_IRQ, dj_irq_lat_fast,
+					  NULL, "irq-latency");
+	else
+		ret = request_irq(DJ_IRQ_LAT_IRQ, dj_irq_lat_handler,
+				  IRQF_DISABLED, "irq-latency", NULL);
+	if (ret)
+		return ret;
+	dj_irq_set_prio(DJ_IRQ_LAT_IRQ, l->prio);
+	dj_irq_lat_cur = l;
+
+	for (i = 0; i < DJ_IRQ_LAT_SHOTS; i++) {
+		INIT_COMPLETION(dj_irq_lat_done);
+		dj_irq_lat_shot(i);
+		if (!wait_for_completion_timeout(&dj_irq_lat_done, HZ)) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+	}
+
+	if (l->fast)
+		dj_fast_irq_free(DJ_IRQ_LAT_IRQ);
+	else
+		free_irq(DJ_IRQ_LAT_IRQ, NULL);
+	return ret;
+}
+
+static int dj_irq_lat_test(void)
+{
+	unsigned int old = dj_irq_prio[DJIO_A_TIMER_IRQ_B_LINE];
+	struct dj_irq_lat *l;
+	int k, ret = 0;
+
+	mutex_lock(&dj_irq_lat_mutex);
+	writew(0, DJIO_A_TIMER + DJIO_A_TIMER_B_PERIOD);
+	writew(0, DJIO_A_TIMER + DJIO_A_TIMER_B_SHOT);
+	dj_irq_lat_enab(1);
+
+	for (k = 0; k < ARRAY_SIZE(dj_irq_lat_passes) && !ret; k++) {
+		l = &dj_irq_lat[k];
+		memset(l, 0, sizeof(*l));
+		l->prio = dj_irq_lat_passes[k].prio;
+		l->fast = dj_irq_lat_passes[k].fast;
+		l->min = ~0UL;
+		ret = dj_irq_lat_pass(l);
+	}
+
+	dj_irq_lat_enab(0);
+	writew(DJIO_A_TIMER_IRQ_B, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ACK);
+	dj_irq_set_prio(DJ_IRQ_LAT_IRQ, old);
+	mutex_unlock(&dj_irq_lat_mutex);
+	return ret;
+}
+
+/* Clicks to ns */
+static unsigned long dj_irq_lat_ns(unsigned long clicks)
+{
+	return clicks * CONFIG_DJ_COUNTER_DIV * 1000 / 16;
+}
+
+static void dj_irq_lat_show(struct seq_file *m)
+{
+	struct dj_irq_lat *l;
+
+	if (!dj_irq_lat[0].shots)
+		return;
+	seq_printf(m, "\nlatency at each priority, ns\n%4s %6s %6s %8s %8s "
+		   "%8s %6s\n", "prio", "path", "shots", "min", "avg", "max",
+		   "in usb");
+	for (l = dj_irq_lat; l < dj_irq_lat + ARRAY_SIZE(dj_irq_lat); l++)
+		if (l->shots)
+			seq_printf(m, "%4u %6s %6u %8lu %8lu %8lu %6u\n",
+				   l->prio, l->fast ? "fast" : "genirq",
+				   l->shots, dj_irq_lat_ns(l->min),
+				   dj_irq_lat_ns(l->sum / l->shots),
+				   dj_irq_lat_ns(l->max), l->in_usb);
+}
+
+#else
+
+static int dj_irq_lat_test(void)
+{
+	return -EINVAL;
+}
+
+static void dj_irq_lat_show(struct seq_file *m)
+{
+}
+
+#endif /* CONFIG_DJ_IRQ_OVERHEAD */
+
+/***************************************************************************/
+
+/*
+ * /proc/dj_irq: every line's priority, and its handler if it has one.
+ * "<line> <prio>" written to it changes a priority, as
+ * dj_irq_set_prio() does, and "test" runs the latency test above.
+ */
+
+static int dj_irq_show(struct seq_file *m, void *v)
+{
+	struct irq_desc *desc;
+	unsigned int n;
+
+	seq_printf(m, "%4s %4s %4s %10s  %s\n", "line", "irq", "prio",
+		   "count", "handler");
+	for (n = 0; n < DJIO_A_IRQ_NLINES; n++) {
+		desc = irq_to_desc(DJIO_IRQ_BASE + n);
+		if (dj_fast_names[n]) {
+			/* fastirq.S keeps no count */
+			seq_printf(m, "%#4x %#4x %4u %10s  %s (fast)%s\n", n,
+				   DJIO_IRQ_BASE + n, dj_irq_prio[n], "-",
+				   dj_fast_names[n],
+				   dj_irq_shadow[n] ? "" : " (masked)");
+			continue;
+		}
+		seq_printf(m, "%#4x %#4x %4u %10u  %s%s\n", n,
+			   DJIO_IRQ_BASE + n, dj_irq_prio[n],
+			   kstat_irqs(DJIO_IRQ_BASE + n),
+			   desc->action ? desc->action->name : "-",
+			   dj_irq_shadow[n] ? "" : " (masked)");
+	}
+	if (dj_fast_dropped)
+		seq_printf(m, "%lu tasklets deferred by fast handlers lost\n",
+			   dj_fast_dropped);
+	dj_irq_lat_show(m);
+	return 0;
+}
+
+static int dj_irq_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dj_irq_show, NULL);
+}
+
+static ssize_t dj_irq_write_proc(struct file *file, const char __user *ubuf,
+				 size_t count, loff_t *ppos)
+{
+	char buf[32], *p;
+	unsigned long n, prio;
+	int ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = 0;
+
+	if (!strncmp(buf, "test", 4)) {
+		ret = dj_irq_lat_test();
+		return ret ? ret : count;
+	}
+	n = simple_strtoul(buf, &p, 0);
+	prio = simple_strtoul(p, &p, 0);
+	if (n >= DJIO_A_IRQ_NLINES)
+		return -EINVAL;
+	ret = dj_irq_set_prio(DJIO_IRQ_BASE + n, prio);
+	return ret ? ret : count;
+}
+
+static const struct file_operations dj_irq_fops = {
+	.open		= dj_irq_open,
+	.read		= seq_read,
+	.write		= dj_irq_write_proc,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init dj_irq_proc_init(void)
+{
+	proc_create("dj_irq", 0644, NULL, &dj_irq_fops);
+	return 0;
+}
+
+device_initcall(dj_irq_proc_init);
+
 void coldfire_reset(void)
 {
 }
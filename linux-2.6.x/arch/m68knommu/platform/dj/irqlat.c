@@ -0,0 +1,399 @@
+/***************************************************************************/
+
+/*
+ *	dj/irqlat.c -- Interrupt latency histograms off a spare ASIC timer.
+ *
+ *	Copyright (C) 2010, Brian S. Julin <bri@abrij.org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston MA 02111-1307, USA.
+ *
+ */
+
+/***************************************************************************/
+
+/*
+ * One of the countdown timers timer.c leaves alone fires a one-shot
+ * every interval_us or so, and the free running counter is read when
+ * the handler gets in and again when the tasklet it schedules runs.
+ * Less the counter value the shot was due at, those go into two log2
+ * histograms, so what is being measured is whatever kept the line
+ * waiting: sections with interrupts off or raised past its level, and
+ * the entry path.  The next shot is armed from the tasklet, so there's
+ * only ever one outstanding, and a second's watchdog rearms it should
+ * one ever get lost.
+ *
+ * It costs an interrupt and a tasklet per shot, so at the default 200
+ * a second it can be left running.  /proc/dj_irqlat shows the
+ * histograms with the max and percentiles; writing "stop", "start" or
+ * "reset" to it does what it says.  With fast=1 the handler goes in
+ * through fastirq.S rather than genirq (see asm/dj/irq.h), and the
+ * tasklet through dj_fast_irq_defer().
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/errno.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/timer.h>
+#include <linux/string.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <asm/io.h>
+#include <asm/div64.h>
+#include <asm/uaccess.h>
+
+#include <asm/dj/djio.h>
+#include <asm/dj/timer.h>
+#include <asm/dj/irq.h>
+
+/* Clicks are 2^k to 2^(k+1)-1 in bucket k, 0 and 1 both in bucket 0 */
+#define DJ_IRQLAT_BUCKETS	32
+
+/* Shortest interval, twice what timer.c will program */
+#define DJ_IRQLAT_MIN_CLICKS	\
+	(2 * DJ_TIMER_MIN_DELTA_NS / 1000 * 16 / CONFIG_DJ_COUNTER_DIV)
+
+static int dj_irqlat_timer = 3;
+module_param_named(timer, dj_irqlat_timer, int, 0444);
+MODULE_PARM_DESC(timer, "countdown timer used, 1 to 4 for B to E (3: D)");
+
+static int dj_irqlat_prio;
+module_param_named(prio, dj_irqlat_prio, int, 0444);
+MODULE_PARM_DESC(prio, "the timer line's priority (0: as irq.c maps it)");
+
+static int dj_irqlat_fast;
+module_param_named(fast, dj_irqlat_fast, bool, 0444);
+MODULE_PARM_DESC(fast, "take the interrupt through fastirq.S, not genirq");
+
+static unsigned int dj_irqlat_interval_us = 5000;
+module_param_named(interval_us, dj_irqlat_interval_us, uint, 0644);
+MODULE_PARM_DESC(interval_us, "mean time between shots, give or take 25%");
+
+struct dj_irqlat_hist {
+	unsigned long bucket[DJ_IRQLAT_BUCKETS];
+	unsigned long count, early, max;
+	unsigned long long sum;
+};
+
+/* At handler entry, and when the tasklet got to run */
+static struct dj_irqlat_hist dj_irqlat_irq, dj_irqlat_defer;
+
+static unsigned int dj_irqlat_tidx, dj_irqlat_irqno;
+static int dj_irqlat_oldprio;		/* to put back, if prio changed it */
+static unsigned long dj_irqlat_due, dj_irqlat_armed;
+static unsigned long dj_irqlat_lost;
+static u32 dj_irqlat_seed = 1;
+static int dj_irqlat_running, dj_irqlat_pending;
+static struct timer_list dj_irqlat_watchdog;
+
+static const u8 dj_irqlat_lines[5] = {
+	DJIO_A_TIMER_IRQ_A_LINE, DJIO_A_TIMER_IRQ_B_LINE,
+	DJIO_A_TIMER_IRQ_C_LINE, DJIO_A_TIMER_IRQ_D_LINE,
+	DJIO_A_TIMER_IRQ_E_LINE,
+};
+
+static inline unsigned long dj_irqlat_now(void)
+{
+	return readl(DJIO_A_TIMER + DJIO_A_TIMER_COUNTER);
+}
+
+static void dj_irqlat_record(struct dj_irqlat_hist *h, unsigned long then)
+{
+	unsigned long d = then - dj_irqlat_due;
+	int k;
+
+	if ((long)d < 0) {
+		/* the lag is a little less than DJ_TIMER_LAG_CLICKS */
+		h->early++;
+		d = 0;
+	}
+	k = d > 1 ? fls(d) - 1 : 0;
+	h->bucket[k]++;
+	h->count++;
+	h->sum += d;
+	if (d > h->max)
+		h->max = d;
+}
+
+/*
+ * The next shot, 75% to 125% of interval_us out so it doesn't lock to
+ * the tick or USB's frames, within what the 16 bit register can count.
+ */
+static void dj_irqlat_arm(void)
+{
+	u16 *sreg = ((u16 *)(DJIO_A_TIMER + DJIO_A_TIMER_A_SHOT)) +
+		dj_irqlat_tidx;
+	unsigned long base, delta, flags;
+
+	base = dj_irqlat_interval_us * 16 / CONFIG_DJ_COUNTER_DIV;
+	base = clamp_t(unsigned long, base, DJ_IRQLAT_MIN_CLICKS, 0xc000);
+	dj_irqlat_seed = dj_irqlat_seed * 1103515245 + 12345;
+	delta = base * 3 / 4 + (dj_irqlat_seed >> 8) % (base / 2);
+
+	local_irq_save(flags);
+	writew(1 << dj_irqlat_tidx, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ACK);
+	dj_irqlat_due = dj_irqlat_now() + delta;
+	writew(delta - DJ_TIMER_LAG_CLICKS, sreg);
+	dj_irqlat_armed = jiffies;
+	dj_irqlat_pending = 1;
+	local_irq_restore(flags);
+}
+
+static void dj_irqlat_deferred(unsigned long data)
+{
+	dj_irqlat_record(&dj_irqlat_defer, dj_irqlat_now());
+	if (dj_irqlat_running)
+		dj_irqlat_arm();
+}
+
+static DECLARE_TASKLET(dj_irqlat_tasklet, dj_irqlat_deferred, 0);
+
+/* Nothing here may touch current: it's the fast handler too */
+static void dj_irqlat_fast_handler(void *dev)
+{
+	unsigned long now = dj_irqlat_now();
+
+	writew(1 << dj_irqlat_tidx, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ACK);
+	dj_irqlat_pending = 0;
+	dj_irqlat_record(&dj_irqlat_irq, now);
+	dj_fast_irq_defer(&dj_irqlat_tasklet);
+}
+
+static irqreturn_t dj_irqlat_handler(int irq, void *dev)
+{
+	unsigned long now = dj_irqlat_now();
+
+	writew(1 << dj_irqlat_tidx, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ACK);
+	dj_irqlat_pending = 0;
+	dj_irqlat_record(&dj_irqlat_irq, now);
+	tasklet_hi_schedule(&dj_irqlat_tasklet);
+	return IRQ_HANDLED;
+}
+
+/* A shot gone a second without its interrupt is counted and replaced */
+static void dj_irqlat_check(unsigned long data)
+{
+	unsigned long flags;
+	int lost;
+
+	local_irq_save(flags);
+	lost = dj_irqlat_running && dj_irqlat_pending &&
+		time_after(jiffies, dj_irqlat_armed + HZ);
+	local_irq_restore(flags);
+	if (lost) {
+		dj_irqlat_lost++;
+		dj_irqlat_arm();
+	}
+	if (dj_irqlat_running)
+		mod_timer(&dj_irqlat_watchdog, jiffies + HZ);
+}
+
+static void dj_irqlat_start(void)
+{
+	if (dj_irqlat_running)
+		return;
+	dj_irqlat_running = 1;
+	dj_timer_frob_enab(dj_irqlat_tidx, 1);
+	dj_irqlat_arm();
+	mod_timer(&dj_irqlat_watchdog, jiffies + HZ);
+}
+
+static void dj_irqlat_stop(void)
+{
+	if (!dj_irqlat_running)
+		return;
+	dj_irqlat_running = 0;
+	del_timer_sync(&dj_irqlat_watchdog);
+	dj_timer_frob_enab(dj_irqlat_tidx, 0);
+	writew(1 << dj_irqlat_tidx, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ACK);
+	tasklet_kill(&dj_irqlat_tasklet);
+	dj_irqlat_pending = 0;
+}
+
+/***************************************************************************/
+
+/*
+ * /proc/dj_irqlat: for each histogram the shots counted, how many came
+ * in before they were due (counted as 0), the average, the max, and the
+ * 50th to 99.9th percentiles, then the buckets that have anything in
+ * them.  The percentiles are the top of the bucket the shot falls in,
+ * so they are never less than the truth, and at most twice it.
+ */
+
+/* Clicks to ns */
+static unsigned long dj_irqlat_ns(unsigned long long clicks)
+{
+	return clicks * CONFIG_DJ_COUNTER_DIV * 1000 / 16;
+}
+
+/* The top of the bucket the n/1000th shot falls in, in clicks */
+static unsigned long dj_irqlat_pct(struct dj_irqlat_hist *h, unsigned int n)
+{
+	unsigned long long want = (unsigned long long)h->count * n;
+	unsigned long seen = 0;
+	int k;
+
+	for (k = 0; k < DJ_IRQLAT_BUCKETS; k++) {
+		seen += h->bucket[k];
+		if ((unsigned long long)seen * 1000 >= want)
+			break;
+	}
+	if (k >= DJ_IRQLAT_BUCKETS - 1)
+		return h->max;
+	return min((2UL << k) - 1, h->max);
+}
+
+static void dj_irqlat_show_hist(struct seq_file *m, const char *name,
+				struct dj_irqlat_hist *h)
+{
+	unsigned long long avg;
+	int k;
+
+	seq_printf(m, "\n%s: %lu shots, %lu early\n", name, h->count,
+		   h->early);
+	if (!h->count)
+		return;
+	avg = h->sum;
+	do_div(avg, h->count);
+	seq_printf(m, "ns avg %lu max %lu p50 %lu p90 %lu p99 %lu p99.9 %lu\n",
+		   dj_irqlat_ns(avg), dj_irqlat_ns(h->max),
+		   dj_irqlat_ns(dj_irqlat_pct(h, 500)),
+		   dj_irqlat_ns(dj_irqlat_pct(h, 900)),
+		   dj_irqlat_ns(dj_irqlat_pct(h, 990)),
+		   dj_irqlat_ns(dj_irqlat_pct(h, 999)));
+	seq_printf(m, "%10s %10s %10s\n", "from ns", "to ns", "shots");
+	for (k = 0; k < DJ_IRQLAT_BUCKETS; k++)
+		if (h->bucket[k])
+			seq_printf(m, "%10lu %10lu %10lu\n",
+				   k ? dj_irqlat_ns(1ULL << k) : 0,
+				   dj_irqlat_ns((2ULL << k) - 1), h->bucket[k]);
+}
+
+static int dj_irqlat_show(struct seq_file *m, void *v)
+{
+	struct dj_irqlat_hist irq, defer;
+	unsigned long flags;
+
+	/* A snapshot, so the percentiles agree with the counts */
+	local_irq_save(flags);
+	irq = dj_irqlat_irq;
+	defer = dj_irqlat_defer;
+	local_irq_restore(flags);
+
+	seq_printf(m, "timer%c, line %#x, %s, %s, every %u us, %lu lost\n",
+		   'A' + dj_irqlat_tidx, dj_irqlat_lines[dj_irqlat_tidx],
+		   dj_irqlat_fast ? "fast" : "genirq",
+		   dj_irqlat_running ? "running" : "stopped",
+		   dj_irqlat_interval_us, dj_irqlat_lost);
+	dj_irqlat_show_hist(m, "handler", &irq);
+	dj_irqlat_show_hist(m, "tasklet", &defer);
+	return 0;
+}
+
+static int dj_irqlat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dj_irqlat_show, NULL);
+}
+
+static ssize_t dj_irqlat_write(struct file *file, const char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+	char buf[16];
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = 0;
+
+	if (!strncmp(buf, "start", 5))
+		dj_irqlat_start();
+	else if (!strncmp(buf, "stop", 4))
+		dj_irqlat_stop();
+	else if (!strncmp(buf, "reset", 5)) {
+		local_irq_save(flags);
+		memset(&dj_irqlat_irq, 0, sizeof(dj_irqlat_irq));
+		memset(&dj_irqlat_defer, 0, sizeof(dj_irqlat_defer));
+		dj_irqlat_lost = 0;
+		local_irq_restore(flags);
+	} else
+		return -EINVAL;
+	return count;
+}
+
+static const struct file_operations dj_irqlat_fops = {
+	.open		= dj_irqlat_open,
+	.read		= seq_read,
+	.write		= dj_irqlat_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/***************************************************************************/
+
+static int __init dj_irqlat_init(void)
+{
+	int ret;
+
+	/* Timer A is the clock event device */
+	if (dj_irqlat_timer < 1 || dj_irqlat_timer > 4 ||
+	    dj_irqlat_prio < 0 || dj_irqlat_prio > DJ_IRQ_PRIO_MAX)
+		return -EINVAL;
+	dj_irqlat_tidx = dj_irqlat_timer;
+	dj_irqlat_irqno = DJIO_IRQ_BASE + dj_irqlat_lines[dj_irqlat_tidx];
+	setup_timer(&dj_irqlat_watchdog, dj_irqlat_check, 0);
+
+	writew(0, ((u16 *)(DJIO_A_TIMER + DJIO_A_TIMER_A_PERIOD)) +
+	       dj_irqlat_tidx);
+	writew(0, ((u16 *)(DJIO_A_TIMER + DJIO_A_TIMER_A_SHOT)) +
+	       dj_irqlat_tidx);
+	if (dj_irqlat_fast)
+		ret = dj_fast_irq_request(dj_irqlat_irqno,
+					  dj_irqlat_fast_handler, NULL,
+					  "irqlat");
+	else
+		ret = request_irq(dj_irqlat_irqno, dj_irqlat_handler,
+				  IRQF_DISABLED, "irqlat", NULL);
+	if (ret)
+		return ret;
+	if (dj_irqlat_prio) {
+		dj_irqlat_oldprio = dj_irq_get_prio(dj_irqlat_irqno);
+		dj_irq_set_prio(dj_irqlat_irqno, dj_irqlat_prio);
+	}
+
+	proc_create("dj_irqlat", 0644, NULL, &dj_irqlat_fops);
+	dj_irqlat_start();
+	return 0;
+}
+
+static void __exit dj_irqlat_exit(void)
+{
+	remove_proc_entry("dj_irqlat", NULL);
+	dj_irqlat_stop();
+	if (dj_irqlat_fast)
+		dj_fast_irq_free(dj_irqlat_irqno);
+	else
+		free_irq(dj_irqlat_irqno, NULL);
+	if (dj_irqlat_oldprio > 0)
+		dj_irq_set_prio(dj_irqlat_irqno, dj_irqlat_oldprio);
+}
+
+module_init(dj_irqlat_init);
+module_exit(dj_irqlat_exit);
+MODULE_LICENSE("GPL");
+
+/***************************************************************************/
@@ -0,0 +1,262 @@
+/***************************************************************************/
+
+/*
+ *	dj/irqsoff.c -- The longest stretches with interrupts off, and where.
+ *
+ *	Copyright (C) 2010, Brian S. Julin <bri@abrij.org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston MA 02111-1307, USA.
+ *
+ */
+
+/***************************************************************************/
+
+/*
+ * asm/dj/irqsoff.h has every local_irq_*() call in here.  Each window
+ * is timed off the free running counter, from the disable that raised
+ * the level to 7 to the enable, restore or rte that lowered it again,
+ * and kept if it's among the DJ_IRQSOFF_SLOTS longest.  A slot is a
+ * pair of places, where it went off and where it came back on, so one
+ * busy section can't crowd out the rest; it holds the longest window
+ * seen between those two, and how many times that pair has run.
+ *
+ * Everything here runs with interrupts off, which is all the locking
+ * there is.  /proc/dj_irqsoff lists the slots longest first with the
+ * addresses in hex, for tools/irqsoffsym.c to look up in System.map;
+ * writing "stop", "start" or "reset" to it does what it says.  The
+ * counter only runs at CONFIG_DJ_COUNTER_DIV once hw_timer_init() has
+ * set it, so nothing is kept before the initcall below.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <asm/io.h>
+#include <asm/div64.h>
+#include <asm/uaccess.h>
+
+#include <asm/dj/djio.h>
+#include <asm/dj/timer.h>
+#include <asm/dj/irqsoff.h>
+
+#define DJ_IRQSOFF_SLOTS	16
+
+struct dj_irqsoff_slot {
+	unsigned long off_ip, on_ip;	/* 0 if the slot is free */
+	unsigned long max;		/* clicks */
+	unsigned long hits;
+};
+
+static struct dj_irqsoff_slot dj_irqsoff_slots[DJ_IRQSOFF_SLOTS];
+static int dj_irqsoff_tracing, dj_irqsoff_open;
+static unsigned long dj_irqsoff_start, dj_irqsoff_ip;
+static unsigned long dj_irqsoff_since;		/* jiffies at reset */
+static unsigned long long dj_irqsoff_total;	/* clicks off in all */
+static unsigned long dj_irqsoff_windows, dj_irqsoff_lost;
+
+static inline unsigned long dj_irqsoff_now(void)
+{
+	return readl(DJIO_A_TIMER + DJIO_A_TIMER_COUNTER);
+}
+
+static inline int dj_irqsoff_is_off(unsigned long sr)
+{
+	return (sr & 0x0700) == 0x0700;
+}
+
+/* Into the pair's own slot if it has one, else a free one or the shortest */
+static void dj_irqsoff_keep(unsigned long off_ip, unsigned long on_ip,
+			    unsigned long d)
+{
+	struct dj_irqsoff_slot *s, *least = dj_irqsoff_slots;
+
+	for (s = dj_irqsoff_slots; s < dj_irqsoff_slots + DJ_IRQSOFF_SLOTS;
+	     s++) {
+		if (s->off_ip == off_ip && s->on_ip == on_ip) {
+			s->hits++;
+			if (d > s->max)
+				s->max = d;
+			return;
+		}
+		if (!s->off_ip) {
+			if (least->off_ip)
+				least = s;
+		} else if (least->off_ip && s->max < least->max)
+			least = s;
+	}
+	if (least->off_ip && d <= least->max)
+		return;
+	least->off_ip = off_ip;
+	least->on_ip = on_ip;
+	least->max = d;
+	least->hits = 1;
+}
+
+void dj_irqsoff_off(unsigned long flags, unsigned long ip)
+{
+	if (!dj_irqsoff_tracing || dj_irqsoff_is_off(flags))
+		return;
+	if (dj_irqsoff_open)
+		dj_irqsoff_lost++;	/* turned back on by something untimed */
+	dj_irqsoff_open = 1;
+	dj_irqsoff_ip = ip;
+	dj_irqsoff_start = dj_irqsoff_now();
+}
+EXPORT_SYMBOL(dj_irqsoff_off);
+
+void dj_irqsoff_on(unsigned long flags, unsigned long ip)
+{
+	unsigned long d;
+
+	if (!dj_irqsoff_open || dj_irqsoff_is_off(flags))
+		return;
+	d = dj_irqsoff_now() - dj_irqsoff_start;
+	dj_irqsoff_open = 0;
+	dj_irqsoff_windows++;
+	dj_irqsoff_total += d;
+	dj_irqsoff_keep(dj_irqsoff_ip, ip, d);
+}
+EXPORT_SYMBOL(dj_irqsoff_on);
+
+/* From entry.S, with the SR its rte is about to put back */
+void dj_irqsoff_rte(unsigned long sr)
+{
+	dj_irqsoff_on(sr, (unsigned long)__builtin_return_address(0));
+}
+
+/***************************************************************************/
+
+/* Clicks to ns; 64 bits, as a total passes 2^32 ns in a few seconds */
+static unsigned long long dj_irqsoff_ns(unsigned long long clicks)
+{
+	clicks *= CONFIG_DJ_COUNTER_DIV * 1000;
+	do_div(clicks, 16);
+	return clicks;
+}
+
+/* And to us, for how long it's been tracing */
+static unsigned long long dj_irqsoff_us(unsigned long long clicks)
+{
+	clicks *= CONFIG_DJ_COUNTER_DIV;
+	do_div(clicks, 16);
+	return clicks;
+}
+
+static int dj_irqsoff_show(struct seq_file *m, void *v)
+{
+	struct dj_irqsoff_slot slots[DJ_IRQSOFF_SLOTS];
+	unsigned long windows, lost, flags;
+	unsigned long long total, elapsed;
+	int i, j;
+
+	/* A snapshot; this window itself goes in once it's over */
+	local_irq_save(flags);
+	memcpy(slots, dj_irqsoff_slots, sizeof(slots));
+	windows = dj_irqsoff_windows;
+	lost = dj_irqsoff_lost;
+	total = dj_irqsoff_total;
+	elapsed = (unsigned long long)(jiffies - dj_irqsoff_since) *
+		DJ_PER_JIFFY_CLICKS;
+	local_irq_restore(flags);
+
+	/* Insertion sort; sort() would be a lib.a object for sixteen */
+	for (i = 1; i < DJ_IRQSOFF_SLOTS; i++)
+		for (j = i; j && slots[j - 1].max < slots[j].max; j--) {
+			struct dj_irqsoff_slot t = slots[j];
+
+			slots[j] = slots[j - 1];
+			slots[j - 1] = t;
+		}
+
+	if (!elapsed)
+		elapsed = 1;
+	seq_printf(m, "%s, %lu windows, %llu ns off of %llu us (%lu.%lu%%), "
+		   "%lu unmatched\n",
+		   dj_irqsoff_tracing ? "tracing" : "stopped", windows,
+		   dj_irqsoff_ns(total), dj_irqsoff_us(elapsed),
+		   (unsigned long)div64_u64(total * 100, elapsed),
+		   (unsigned long)div64_u64(total * 1000, elapsed) % 10, lost);
+	seq_printf(m, "%10s %8s %10s %10s\n", "max ns", "hits", "off", "on");
+	for (i = 0; i < DJ_IRQSOFF_SLOTS; i++)
+		if (slots[i].off_ip)
+			seq_printf(m, "%10llu %8lu 0x%08lx 0x%08lx\n",
+				   dj_irqsoff_ns(slots[i].max), slots[i].hits,
+				   slots[i].off_ip, slots[i].on_ip);
+	return 0;
+}
+
+static int dj_irqsoff_open_proc(struct inode *inode, struct file *file)
+{
+	return single_open(file, dj_irqsoff_show, NULL);
+}
+
+static ssize_t dj_irqsoff_write(struct file *file, const char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+	ssize_t ret = count;
+	char buf[16];
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = 0;
+
+	local_irq_save(flags);
+	if (!strncmp(buf, "start", 5))
+		dj_irqsoff_tracing = 1;
+	else if (!strncmp(buf, "stop", 4)) {
+		dj_irqsoff_tracing = 0;
+		dj_irqsoff_open = 0;
+	} else if (!strncmp(buf, "reset", 5)) {
+		memset(dj_irqsoff_slots, 0, sizeof(dj_irqsoff_slots));
+		dj_irqsoff_windows = dj_irqsoff_lost = 0;
+		dj_irqsoff_total = 0;
+		dj_irqsoff_since = jiffies;
+	} else
+		ret = -EINVAL;
+	local_irq_restore(flags);
+	return ret;
+}
+
+static const struct file_operations dj_irqsoff_fops = {
+	.open		= dj_irqsoff_open_proc,
+	.read		= seq_read,
+	.write		= dj_irqsoff_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* The counter's running at its own rate by now */
+static int __init dj_irqsoff_init(void)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	dj_irqsoff_since = jiffies;
+	dj_irqsoff_tracing = 1;
+	local_irq_restore(flags);
+	proc_create("dj_irqsoff", 0644, NULL, &dj_irqsoff_fops);
+	return 0;
+}
+
+core_initcall(dj_irqsoff_init);
+
+/***************************************************************************/
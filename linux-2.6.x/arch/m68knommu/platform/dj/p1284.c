@@ -0,0 +1,623 @@
+/***************************************************************************/
+
+/*
+ *	dj/p1284.c -- Deskjet peripheral-side p1284 port: ECP console link.
+ *
+ *	Copyright (C) 2009-2010, Brian S. Julin <bri@abrij.org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston MA 02111-1307, USA.
+ *
+ */
+
+/***************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/moduleparam.h>
+#include <linux/console.h>
+#include <linux/tty.h>
+#include <linux/tty_driver.h>
+#include <linux/tty_flip.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/circ_buf.h>
+#include <linux/delay.h>
+#include <linux/notifier.h>
+#include <linux/reboot.h>
+#include <linux/io.h>
+
+#include <asm/dj/djio.h>
+#include <asm/dj/p1284.h>
+#include <asm/dj/reload.h>
+
+/***************************************************************************/
+
+/* Register access */
+
+static inline u8 dj_p1284_read_data (void) {
+	return readb(DJIO_A_P1284 + DJIO_A_P1284_DATA);
+}
+
+static inline u8 dj_p1284_read_stat (void) {
+	return readb(DJIO_A_P1284 + DJIO_A_P1284_STAT) & DJIO_A_P1284_STAT_MASK;
+}
+
+static inline void dj_p1284_write_data (u8 v) {
+	writeb(v, DJIO_A_P1284 + DJIO_A_P1284_DATA);
+}
+
+static inline void dj_p1284_write_cntl (u8 v) {
+	writeb(v, DJIO_A_P1284 + DJIO_A_P1284_CNTL);
+}
+
+static inline u8 dj_p1284_frob_cntl(u8 v, u8 mask) {
+	v &= mask;
+	mask = ~mask;
+	mask &= readb(DJIO_A_P1284 + DJIO_A_P1284_CNTL);
+	v |= mask;
+	writeb(v, DJIO_A_P1284 + DJIO_A_P1284_CNTL);
+	return v;
+}
+
+static inline u8 dj_p1284_frob_cfg1(u8 v, u8 mask) {
+	v &= mask;
+	mask = ~mask;
+	mask &= readb(DJIO_A_P1284 + DJIO_A_P1284_CFG1);
+	v |= mask;
+	writeb(v, DJIO_A_P1284 + DJIO_A_P1284_CFG1);
+	return v;
+}
+
+/***************************************************************************/
+
+/* Byte level ECP, with busy polling */
+
+/**
+ * dj_p1284_putb: send one byte to the host in reverse mode
+ * @c: the byte
+ * @cmd: nonzero to send it as an ECP command (channel address or run
+ *	length) byte
+ *
+ * This is the handshake the old polled console did for every character,
+ * except that it will not wait for the host to be idle in the first
+ * place: if it is not, we return -1 right away and try again later.
+ */
+static int dj_p1284_putb(u8 c, int cmd)
+{
+	u8 flag = cmd ? REVERSEREQ_CMD : 0;
+	int i;
+
+	dj_p1284_write_cntl(REVERSEREQ_O1);
+	if (dj_p1284_read_stat() != REVERSEREQ_I1)
+		return -1;
+	dj_p1284_write_cntl(REVERSEREQ_O2);
+	i = DJ_P1284_SPIN;
+	while (--i) {
+		if (dj_p1284_read_stat() == REVERSEREQ_I2) break;
+	}
+	if (!i) goto abort;
+	dj_p1284_write_cntl(REVERSEREQ_O3 | flag);
+	dj_p1284_frob_cfg1(DJIO_A_P1284_CTL1_DDRV, DJIO_A_P1284_CTL1_DDRV);
+	dj_p1284_write_data(c);
+	dj_p1284_write_cntl(REVERSEREQ_O4 | flag);
+	i = DJ_P1284_SPIN;
+	while (--i) {
+		if (dj_p1284_read_stat() == REVERSEREQ_I3) break;
+	}
+	if (!i) {
+		dj_p1284_frob_cfg1(0, DJIO_A_P1284_CTL1_DDRV);
+		goto abort;
+	}
+	dj_p1284_write_cntl(REVERSEREQ_O3);
+	i = DJ_P1284_SPIN;
+	while (--i) {
+		if (dj_p1284_read_stat() == REVERSEREQ_I2
+		    || dj_p1284_read_stat() == REVERSEREQ_I1)
+			break;
+	}
+	dj_p1284_frob_cfg1(0, DJIO_A_P1284_CTL1_DDRV);
+	if (!i) goto abort;
+	i = DJ_P1284_SPIN;
+	while (--i) {
+		if (dj_p1284_read_stat() == REVERSEREQ_I1) break;
+	}
+	if (!i) goto abort;
+	dj_p1284_write_cntl(REVERSEREQ_O2);
+	i = DJ_P1284_SPIN;
+	while (--i) {}
+	dj_p1284_write_cntl(REVERSEREQ_O1);
+	return 0;
+ abort:
+	dj_p1284_write_cntl(REVERSEREQ_O1);
+	return -1;
+}
+
+/**
+ * dj_p1284_getb: take one forward byte from the host, if it is sending
+ * @c: where to put the byte
+ *
+ * The host puts the byte on the bus with HostAck high for data or low
+ * for a command, then drops HostClk.  We answer on PeriphAck and wait
+ * for HostClk to come back up.  Returns -1 if the host is not strobing
+ * a byte at us, else 1 for a command byte and 0 for data.
+ */
+static int dj_p1284_getb(u8 *c)
+{
+	u8 st;
+	int i;
+
+	st = dj_p1284_read_stat();
+	if ((st & (DJIO_A_P1284_STAT_01 | DJIO_A_P1284_STAT_16 |
+		   DJIO_A_P1284_STAT_17)) !=
+	    (DJIO_A_P1284_STAT_16 | DJIO_A_P1284_STAT_17))
+		return -1;
+	*c = dj_p1284_read_data();
+	dj_p1284_frob_cntl(DJIO_A_P1284_CNTL_11, DJIO_A_P1284_CNTL_11);
+	i = DJ_P1284_SPIN;
+	while (--i) {
+		if (dj_p1284_read_stat() & DJIO_A_P1284_STAT_01) break;
+	}
+	dj_p1284_frob_cntl(0, DJIO_A_P1284_CNTL_11);
+	/* We have the byte either way; a host that gave up will resend */
+	return (st & DJIO_A_P1284_STAT_14) ? 0 : 1;
+}
+
+/***************************************************************************/
+
+/* Channels */
+
+/* Per-channel reverse queue; a power of two for the circ_buf macros */
+#define DJ_P1284_QSIZE		1024
+
+/*
+ * Forward bytes taken and reverse bytes sent per pass, each at most, so
+ * that neither direction holds up the other for long.  Passes follow
+ * each other straight away while bytes are moving.
+ */
+#define DJ_P1284_RX_BUDGET	64
+#define DJ_P1284_TX_BUDGET	8
+
+/*
+ * A new kernel on the reload channel gets a lot more, since nothing
+ * else is going on.  It still stops the moment the host does.  Bytes go
+ * to dj_reload_write() DJ_P1284_RELOAD_CHUNK at a time.
+ */
+#define DJ_P1284_RELOAD_BUDGET	4096
+#define DJ_P1284_RELOAD_CHUNK	256
+
+/* How long a restart waits for the host to take the last of the log */
+#define DJ_P1284_DRAIN_MS	200
+
+/* Bulk bytes in a row before the kernel log gets a look in */
+#define DJ_P1284_BULK_RUN	64
+
+/*
+ * Run length encoding: a command byte n with bit 7 clear stands the
+ * data byte after it for n + 1 copies.  We always decode it; we only
+ * encode for a host that negotiated ECP with RLE, which we cannot see
+ * from here, so that is up to "p1284.rle=1" or the sysfs parameter.
+ * Runs shorter than DJ_P1284_RLE_MIN go as they are.
+ */
+#define DJ_P1284_RLE_MIN	3
+#define DJ_P1284_RLE_MAX	128
+
+static int dj_p1284_rle;
+module_param_named(rle, dj_p1284_rle, bool, 0644);
+MODULE_PARM_DESC(rle, "Run length encode data to the host (needs ECP RLE)");
+
+struct dj_p1284_chan {
+	struct tty_struct *tty;		/* while open, channels with a tty */
+	int count;			/* opens */
+	unsigned int head, tail;	/* reverse queue, circ_buf style */
+	u8 buf[DJ_P1284_QSIZE];
+	unsigned long sent, dropped;
+};
+
+static struct dj_p1284_chan dj_p1284_chans[DJ_P1284_NCHAN];
+static DEFINE_SPINLOCK(dj_p1284_lock);
+static struct task_struct *dj_p1284_task;
+static struct tty_driver *dj_p1284_tty_driver;
+
+/* What channel each direction of the link is on; -1 before we know */
+static int dj_p1284_txch = -1;
+static int dj_p1284_rxch = DJ_P1284_CH_CONSOLE;
+static int dj_p1284_bulk_run;
+
+/* Copies the next forward byte stands for; a reverse run half sent */
+static int dj_p1284_rlein;
+static int dj_p1284_rleout;
+
+static int dj_p1284_queue(struct dj_p1284_chan *ch, const u8 *s, int count)
+{
+	unsigned long flags;
+	int n, room;
+
+	spin_lock_irqsave(&dj_p1284_lock, flags);
+	room = CIRC_SPACE(ch->head, ch->tail, DJ_P1284_QSIZE);
+	if (count > room)
+		count = room;
+	for (n = 0; n < count; n++) {
+		ch->buf[ch->head] = s[n];
+		ch->head = (ch->head + 1) & (DJ_P1284_QSIZE - 1);
+	}
+	spin_unlock_irqrestore(&dj_p1284_lock, flags);
+	return count;
+}
+
+/**
+ * dj_p1284_pick: choose the channel whose byte goes out next
+ *
+ * The console always goes first, so a keystroke echo never waits
+ * behind more than the one byte already on the wire plus a channel
+ * address.  The kernel log is next, and bulk gets what is left over,
+ * though only DJ_P1284_BULK_RUN bytes in a row while the log waits.
+ * Called with dj_p1284_lock held.  Returns -1 when nothing is queued.
+ */
+static int dj_p1284_pick(void)
+{
+	struct dj_p1284_chan *c = dj_p1284_chans;
+	int bulk = CIRC_CNT(c[DJ_P1284_CH_BULK].head,
+			    c[DJ_P1284_CH_BULK].tail, DJ_P1284_QSIZE);
+	int klog = CIRC_CNT(c[DJ_P1284_CH_KLOG].head,
+			    c[DJ_P1284_CH_KLOG].tail, DJ_P1284_QSIZE);
+
+	if (CIRC_CNT(c[DJ_P1284_CH_CONSOLE].head,
+		     c[DJ_P1284_CH_CONSOLE].tail, DJ_P1284_QSIZE))
+		return DJ_P1284_CH_CONSOLE;
+	if (klog && (!bulk || dj_p1284_bulk_run >= DJ_P1284_BULK_RUN)) {
+		dj_p1284_bulk_run = 0;
+		return DJ_P1284_CH_KLOG;
+	}
+	if (bulk) {
+		dj_p1284_bulk_run++;
+		return DJ_P1284_CH_BULK;
+	}
+	return -1;
+}
+
+/*
+ * Length of the run of equal bytes at the head of a channel's queue,
+ * up to what one count can cover.  Called with dj_p1284_lock held.
+ */
+static int dj_p1284_run(struct dj_p1284_chan *ch)
+{
+	int n, cnt = CIRC_CNT(ch->head, ch->tail, DJ_P1284_QSIZE);
+	unsigned int i = ch->tail;
+
+	if (cnt > DJ_P1284_RLE_MAX)
+		cnt = DJ_P1284_RLE_MAX;
+	for (n = 1; n < cnt; n++) {
+		i = (i + 1) & (DJ_P1284_QSIZE - 1);
+		if (ch->buf[i] != ch->buf[ch->tail])
+			break;
+	}
+	return n;
+}
+
+static int dj_p1284_rx(void)
+{
+	static u8 reload[DJ_P1284_RELOAD_CHUNK];
+	struct tty_struct *tty;
+	int n, taken, cmd, reps, pushed = 0, rl = 0;
+	u8 c;
+
+	for (n = 0; n < (dj_p1284_rxch == DJ_P1284_CH_RELOAD ?
+			 DJ_P1284_RELOAD_BUDGET : DJ_P1284_RX_BUDGET); n++) {
+		cmd = dj_p1284_getb(&c);
+		if (cmd < 0)
+			break;
+		if (cmd) {
+			if (!(c & DJ_P1284_CMD_CHAN))
+				dj_p1284_rlein = c + 1;
+			else if ((c & ~DJ_P1284_CMD_CHAN) < DJ_P1284_NTTY ||
+				 (c & ~DJ_P1284_CMD_CHAN) == DJ_P1284_CH_RELOAD)
+				dj_p1284_rxch = c & ~DJ_P1284_CMD_CHAN;
+			continue;
+		}
+		reps = dj_p1284_rlein ? dj_p1284_rlein : 1;
+		dj_p1284_rlein = 0;
+		if (dj_p1284_rxch == DJ_P1284_CH_RELOAD) {
+			while (reps--) {
+				reload[rl++] = c;
+				if (rl == DJ_P1284_RELOAD_CHUNK) {
+					dj_reload_write(reload, rl);
+					rl = 0;
+				}
+			}
+			continue;
+		}
+		tty = dj_p1284_chans[dj_p1284_rxch].tty;
+		if (tty) {
+			while (reps--)
+				tty_insert_flip_char(tty, c, TTY_NORMAL);
+			pushed |= 1 << dj_p1284_rxch;
+		}
+	}
+	taken = n;
+	if (rl)
+		dj_reload_write(reload, rl);
+	for (n = 0; n < DJ_P1284_NTTY; n++)
+		if ((pushed & (1 << n)) && dj_p1284_chans[n].tty)
+			tty_flip_buffer_push(dj_p1284_chans[n].tty);
+	return taken;
+}
+
+static int dj_p1284_tx(void)
+{
+	struct dj_p1284_chan *ch;
+	unsigned long flags;
+	int n, sent, sel, run, woke = 0;
+	u8 c;
+
+	for (n = 0; n < DJ_P1284_TX_BUDGET; n++) {
+		spin_lock_irqsave(&dj_p1284_lock, flags);
+		/* The host has a run's count: its byte goes before anything */
+		sel = dj_p1284_rleout ? dj_p1284_txch : dj_p1284_pick();
+		if (sel >= 0) {
+			ch = &dj_p1284_chans[sel];
+			c = ch->buf[ch->tail];
+			if (dj_p1284_rleout)
+				run = dj_p1284_rleout;
+			else
+				run = dj_p1284_rle ? dj_p1284_run(ch) : 1;
+		}
+		spin_unlock_irqrestore(&dj_p1284_lock, flags);
+		if (sel < 0)
+			break;
+
+		if (sel != dj_p1284_txch) {
+			if (dj_p1284_putb(DJ_P1284_CMD_CHAN | sel, 1))
+				break;
+			dj_p1284_txch = sel;
+		}
+		if (run < DJ_P1284_RLE_MIN) {
+			run = 1;
+		} else if (!dj_p1284_rleout) {
+			if (dj_p1284_putb(run - 1, 1))
+				break;
+			dj_p1284_rleout = run;
+		}
+		if (dj_p1284_putb(c, 0))
+			break;
+		dj_p1284_rleout = 0;
+
+		spin_lock_irqsave(&dj_p1284_lock, flags);
+		ch->tail = (ch->tail + run) & (DJ_P1284_QSIZE - 1);
+		ch->sent += run;
+		spin_unlock_irqrestore(&dj_p1284_lock, flags);
+		woke |= 1 << sel;
+	}
+	sent = n;
+	for (n = 0; n < DJ_P1284_NTTY; n++)
+		if ((woke & (1 << n)) && dj_p1284_chans[n].tty)
+			tty_wakeup(dj_p1284_chans[n].tty);
+	return sent;
+}
+
+/* Whether anything is left for the host.  Called with dj_p1284_lock held. */
+static int dj_p1284_pending(void)
+{
+	int n;
+
+	if (dj_p1284_rleout)
+		return 1;
+	for (n = 0; n < DJ_P1284_NCHAN; n++)
+		if (CIRC_CNT(dj_p1284_chans[n].head, dj_p1284_chans[n].tail,
+			     DJ_P1284_QSIZE))
+			return 1;
+	return 0;
+}
+
+/* One pass each way; returns how many bytes it moved */
+static int dj_p1284_poll(void)
+{
+	unsigned long flags;
+	int pending, moved;
+
+	moved = dj_p1284_rx();
+	moved += dj_p1284_tx();
+
+	/*
+	 * PeriphRequest (nFault) low for as long as we have something to
+	 * send, so the host only turns the bus around when it's worth it.
+	 * dj_p1284_putb() idles with it high, so this goes after it.
+	 */
+	spin_lock_irqsave(&dj_p1284_lock, flags);
+	pending = dj_p1284_pending();
+	spin_unlock_irqrestore(&dj_p1284_lock, flags);
+	dj_p1284_frob_cntl(pending ? 0 : DJIO_A_P1284_CNTL_15,
+			   DJIO_A_P1284_CNTL_15);
+	return moved;
+}
+
+/*
+ * The port raises no interrupt we know of, so a thread runs the link:
+ * pass after pass while bytes are moving, and once a jiffy while they
+ * are not, to see whether the host has started strobing or turned the
+ * bus round to take what we have queued.
+ *
+ * At 10 MHz that leaves forward bytes costing what dj_p1284_getb() and
+ * the tty echo take, around 16 us, for something near 60 KB/s.  Reverse
+ * is held to a little under 500 bytes/s by the DJ_P1284_SPIN pass wait,
+ * about 2 ms, that dj_p1284_putb() ends every byte with.  Either way
+ * the first byte after the link has been idle can wait up to a jiffy.
+ */
+static int dj_p1284_thread(void *unused)
+{
+	while (!kthread_should_stop()) {
+		if (dj_p1284_poll())
+			cond_resched();
+		else
+			schedule_timeout_interruptible(1);
+	}
+	return 0;
+}
+
+/***************************************************************************/
+
+/* tty glue, one line per channel that has one */
+
+static int dj_p1284_tty_open(struct tty_struct *tty, struct file *filp)
+{
+	struct dj_p1284_chan *ch = &dj_p1284_chans[tty->index];
+	unsigned long flags;
+
+	spin_lock_irqsave(&dj_p1284_lock, flags);
+	tty->driver_data = ch;
+	ch->tty = tty;
+	ch->count++;
+	spin_unlock_irqrestore(&dj_p1284_lock, flags);
+	return 0;
+}
+
+static void dj_p1284_tty_close(struct tty_struct *tty, struct file *filp)
+{
+	struct dj_p1284_chan *ch = tty->driver_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dj_p1284_lock, flags);
+	if (ch && !--ch->count)
+		ch->tty = NULL;
+	spin_unlock_irqrestore(&dj_p1284_lock, flags);
+}
+
+static int dj_p1284_tty_write(struct tty_struct *tty,
+			      const unsigned char *buf, int count)
+{
+	return dj_p1284_queue(tty->driver_data, buf, count);
+}
+
+static int dj_p1284_tty_write_room(struct tty_struct *tty)
+{
+	struct dj_p1284_chan *ch = tty->driver_data;
+
+	return CIRC_SPACE(ch->head, ch->tail, DJ_P1284_QSIZE);
+}
+
+static int dj_p1284_tty_chars_in_buffer(struct tty_struct *tty)
+{
+	struct dj_p1284_chan *ch = tty->driver_data;
+
+	return CIRC_CNT(ch->head, ch->tail, DJ_P1284_QSIZE);
+}
+
+static const struct tty_operations dj_p1284_tty_ops = {
+	.open		 = dj_p1284_tty_open,
+	.close		 = dj_p1284_tty_close,
+	.write		 = dj_p1284_tty_write,
+	.write_room	 = dj_p1284_tty_write_room,
+	.chars_in_buffer = dj_p1284_tty_chars_in_buffer,
+};
+
+/***************************************************************************/
+
+/* Kernel log channel */
+
+void dj_p1284_console_write (struct console *co, const char *s,
+			     unsigned count)
+{
+	struct dj_p1284_chan *ch = &dj_p1284_chans[DJ_P1284_CH_KLOG];
+	int n;
+
+	/* Never wait here; whatever does not fit is counted and lost */
+	n = dj_p1284_queue(ch, s, count);
+	ch->dropped += count - n;
+}
+
+static struct console dj_p1284_cons = {
+	.name           = "lp",
+	.write          = dj_p1284_console_write,
+	.flags          = CON_PRINTBUFFER,
+	.index		= -1,
+};
+
+int setup_dj_p1284_console(void)
+{
+	register_console(&dj_p1284_cons);
+	return 0;
+}
+
+/***************************************************************************/
+
+/*
+ * On the way down for a restart, warm reload included: let the host
+ * have what's left of the log, within reason, then stop polling and
+ * leave the port idle, so a new kernel finds it as the ROM left it and
+ * tools/ecprxtx carries on as if nothing happened.
+ */
+static int dj_p1284_reboot(struct notifier_block *nb, unsigned long event,
+			   void *unused)
+{
+	unsigned long flags;
+	int i, pending = 1;
+
+	for (i = 0; pending && i < DJ_P1284_DRAIN_MS / 10; i++) {
+		msleep(10);
+		spin_lock_irqsave(&dj_p1284_lock, flags);
+		pending = dj_p1284_pending();
+		spin_unlock_irqrestore(&dj_p1284_lock, flags);
+	}
+	kthread_stop(dj_p1284_task);
+	dj_p1284_frob_cfg1(0, DJIO_A_P1284_CTL1_DDRV);
+	dj_p1284_write_cntl(REVERSEREQ_O1);
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block dj_p1284_reboot_nb = {
+	.notifier_call	= dj_p1284_reboot,
+};
+
+/***************************************************************************/
+
+static int __init dj_p1284_init(void)
+{
+	struct tty_driver *drv;
+	int ret;
+
+	drv = alloc_tty_driver(DJ_P1284_NTTY);
+	if (!drv)
+		return -ENOMEM;
+	drv->owner = THIS_MODULE;
+	drv->driver_name = "dj_p1284";
+	drv->name = "ttyP";
+	drv->major = 0;
+	drv->type = TTY_DRIVER_TYPE_SERIAL;
+	drv->subtype = SERIAL_TYPE_NORMAL;
+	drv->init_termios = tty_std_termios;
+	drv->flags = TTY_DRIVER_REAL_RAW;
+	tty_set_operations(drv, &dj_p1284_tty_ops);
+	ret = tty_register_driver(drv);
+	if (ret) {
+		put_tty_driver(drv);
+		return ret;
+	}
+	dj_p1284_tty_driver = drv;
+
+	setup_dj_p1284_console();
+	dj_p1284_task = kthread_run(dj_p1284_thread, NULL, "dj_p1284");
+	if (IS_ERR(dj_p1284_task)) {
+		ret = PTR_ERR(dj_p1284_task);
+		unregister_console(&dj_p1284_cons);
+		tty_unregister_driver(drv);
+		put_tty_driver(drv);
+		dj_p1284_tty_driver = NULL;
+		return ret;
+	}
+	register_reboot_notifier(&dj_p1284_reboot_nb);
+	return 0;
+}
+
+device_initcall(dj_p1284_init);
+
+/***************************************************************************/
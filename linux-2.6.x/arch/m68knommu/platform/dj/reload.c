@@ -0,0 +1,296 @@
+/***************************************************************************/
+
+/*
+ *	dj/reload.c -- Warm reload: start a new kernel without the boot ROM.
+ *
+ *	Copyright (C) 2010, Brian S. Julin <bri@abrij.org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston MA 02111-1307, USA.
+ *
+ */
+
+/***************************************************************************/
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/moduleparam.h>
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/miscdevice.h>
+#include <linux/reboot.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <asm/cacheflush.h>
+#include <asm/uaccess.h>
+
+#include <asm/dj/ecpboot.h>
+#include <asm/dj/irq.h>
+#include <asm/dj/timer.h>
+#include <asm/dj/reload.h>
+
+/* reload_tramp.S; copied out of the way of the new image before it runs */
+extern void dj_reload_tramp(const void *src, void *dst, unsigned long words,
+			    unsigned long entry);
+extern char dj_reload_tramp_end[];
+
+#define DJ_RELOAD_TRAMP_LEN \
+	((unsigned long)dj_reload_tramp_end - (unsigned long)dj_reload_tramp)
+
+/* Bytes per copy_from_user() on the /dev/djreload path */
+#define DJ_RELOAD_CHUNK		256
+
+/* Built in as reload.o, but documented and asked for as dj_reload.size */
+#undef MODULE_PARAM_PREFIX
+#define MODULE_PARAM_PREFIX "dj_reload."
+
+static int dj_reload_size_kb = DJ_RELOAD_SIZE_KB;
+module_param_named(size, dj_reload_size_kb, int, 0444);
+MODULE_PARM_DESC(size, "KiB kept aside at boot for a new kernel image");
+
+static struct {
+	u8 *buf;			/* the reserve, and its length */
+	unsigned long len;
+	u8 hdr[DJ_RELOAD_HDR_LEN];	/* header so far */
+	int hlen;
+	unsigned long load, entry, size, crc;
+	unsigned long got;		/* image bytes so far */
+	int ready;			/* all there; the rest is up to the work */
+} dj_reload;
+
+static DEFINE_SPINLOCK(dj_reload_lock);
+static unsigned long dj_reload_crctab[256];
+
+static void dj_reload_work_fn(struct work_struct *work);
+static DECLARE_WORK(dj_reload_work, dj_reload_work_fn);
+
+/***************************************************************************/
+
+static unsigned long dj_reload_get32(const u8 *p)
+{
+	return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+		((unsigned long)p[2] << 8) | p[3];
+}
+
+/* Whether [a, a + alen) and [b, b + blen) have a byte in common */
+static int dj_reload_overlap(unsigned long a, unsigned long alen,
+			     unsigned long b, unsigned long blen)
+{
+	return a < b + blen && b < a + alen;
+}
+
+/*
+ * Take a header apart, and say whether we can do what it asks.  The
+ * image is copied to its load address upwards, a word at a time, by a
+ * trampoline sitting just past it in the reserve; so the copy must not
+ * run into the trampoline, nor into bytes it hasn't read yet.  Called
+ * with dj_reload_lock held.
+ */
+static int dj_reload_header(void)
+{
+	unsigned long src = (unsigned long)dj_reload.buf, span;
+
+	dj_reload.load = dj_reload_get32(dj_reload.hdr + 4);
+	dj_reload.entry = dj_reload_get32(dj_reload.hdr + 8);
+	dj_reload.size = dj_reload_get32(dj_reload.hdr + 12);
+	dj_reload.crc = dj_reload_get32(dj_reload.hdr + 16);
+	span = ALIGN(dj_reload.size, 4);
+
+	if (!dj_reload.size ||
+	    span + DJ_RELOAD_TRAMP_LEN > dj_reload.len) {
+		printk(KERN_ERR "dj_reload: %lu byte image, room for %lu\n",
+		       dj_reload.size, dj_reload.len - DJ_RELOAD_TRAMP_LEN);
+		return -EFBIG;
+	}
+	if (dj_reload.entry < dj_reload.load ||
+	    dj_reload.entry >= dj_reload.load + dj_reload.size ||
+	    (dj_reload.load > src && dj_reload.load < src + span) ||
+	    dj_reload_overlap(dj_reload.load, span,
+			      src + span, DJ_RELOAD_TRAMP_LEN)) {
+		printk(KERN_ERR "dj_reload: can't start an image at %#lx "
+		       "loaded at %#lx from %#lx\n",
+		       dj_reload.entry, dj_reload.load, src);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * dj_reload_write: feed bytes of a reload stream
+ * @p: the bytes
+ * @n: how many
+ *
+ * Header first, then the image; anything before a header is skipped
+ * a byte at a time until the magic turns up.  Once the image is all
+ * there the rest happens from a workqueue, and until that is done (or
+ * has failed) we take nothing more.  Safe from any context.
+ */
+int dj_reload_write(const u8 *p, size_t n)
+{
+	unsigned long flags, take;
+	int ret = 0;
+
+	spin_lock_irqsave(&dj_reload_lock, flags);
+	if (!dj_reload.buf || dj_reload.ready) {
+		ret = dj_reload.buf ? -EBUSY : -ENOMEM;
+		goto out;
+	}
+	while (n) {
+		if (dj_reload.hlen < DJ_RELOAD_HDR_LEN) {
+			dj_reload.hdr[dj_reload.hlen++] = *p++;
+			n--;
+			if (dj_reload.hlen == 4 &&
+			    dj_reload_get32(dj_reload.hdr) != DJ_RELOAD_MAGIC) {
+				memmove(dj_reload.hdr, dj_reload.hdr + 1, 3);
+				dj_reload.hlen = 3;
+			}
+			if (dj_reload.hlen == DJ_RELOAD_HDR_LEN) {
+				ret = dj_reload_header();
+				if (ret)
+					dj_reload.hlen = 0;
+				dj_reload.got = 0;
+			}
+			continue;
+		}
+		take = dj_reload.size - dj_reload.got;
+		if (take > n)
+			take = n;
+		memcpy(dj_reload.buf + dj_reload.got, p, take);
+		dj_reload.got += take;
+		p += take;
+		n -= take;
+		if (dj_reload.got == dj_reload.size) {
+			dj_reload.ready = 1;
+			schedule_work(&dj_reload_work);
+			break;
+		}
+	}
+ out:
+	spin_unlock_irqrestore(&dj_reload_lock, flags);
+	return ret;
+}
+
+/***************************************************************************/
+
+/*
+ * Check the image, then take everything down as a restart would, and
+ * jump.  Reboot notifiers stop the P1284 poll and the UDC; the timer
+ * and interrupt controller we stop ourselves, as nothing else would
+ * before the new kernel's hw_timer_init() and init_IRQ() run.
+ */
+static void dj_reload_work_fn(struct work_struct *work)
+{
+	void (*tramp)(const void *src, void *dst, unsigned long words,
+		      unsigned long entry);
+	unsigned long flags, crc, span = ALIGN(dj_reload.size, 4);
+
+	crc = ecpboot_crc(dj_reload_crctab, 0, dj_reload.buf, dj_reload.size);
+	if (crc != dj_reload.crc) {
+		printk(KERN_ERR "dj_reload: image CRC %08lx, expected %08lx\n",
+		       crc, dj_reload.crc);
+		spin_lock_irqsave(&dj_reload_lock, flags);
+		dj_reload.hlen = 0;
+		dj_reload.ready = 0;
+		spin_unlock_irqrestore(&dj_reload_lock, flags);
+		return;
+	}
+	printk(KERN_NOTICE "dj_reload: %lu bytes at %#lx check out, "
+	       "restarting at %#lx\n", dj_reload.size, dj_reload.load,
+	       dj_reload.entry);
+
+	kernel_restart_prepare(NULL);
+	local_irq_disable();
+	dj_timer_quiesce();
+	dj_irq_quiesce();
+
+	tramp = (void *)(dj_reload.buf + span);
+	memcpy(tramp, dj_reload_tramp, DJ_RELOAD_TRAMP_LEN);
+	flush_icache_range((unsigned long)tramp,
+			   (unsigned long)tramp + DJ_RELOAD_TRAMP_LEN);
+	tramp(dj_reload.buf, (void *)dj_reload.load, span / 4,
+	      dj_reload.entry);
+}
+
+/***************************************************************************/
+
+/* /dev/djreload, for images that come some other way, such as ttyGS0 */
+
+static ssize_t dj_reload_dev_write(struct file *file, const char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	u8 chunk[DJ_RELOAD_CHUNK];
+	size_t done = 0, n;
+	int ret;
+
+	while (done < count) {
+		n = min_t(size_t, count - done, sizeof(chunk));
+		if (copy_from_user(chunk, ubuf + done, n))
+			return done ? done : -EFAULT;
+		ret = dj_reload_write(chunk, n);
+		/* A bad header is said in the log; carry on looking for more */
+		if (ret == -EBUSY || ret == -ENOMEM)
+			return done ? done : ret;
+		done += n;
+	}
+	return done;
+}
+
+static const struct file_operations dj_reload_fops = {
+	.owner	= THIS_MODULE,
+	.write	= dj_reload_dev_write,
+};
+
+static struct miscdevice dj_reload_dev = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= "djreload",
+	.fops	= &dj_reload_fops,
+};
+
+/***************************************************************************/
+
+/*
+ * The reserve is taken early, before the page allocator has been chewed
+ * up: on 2 MB there may not be half a megabyte in one piece by the time
+ * drivers are done.  The device node has to wait for the misc class.
+ */
+static int __init dj_reload_reserve(void)
+{
+	unsigned long len = dj_reload_size_kb * 1024UL;
+
+	ecpboot_crc_init(dj_reload_crctab);
+	dj_reload.buf = alloc_pages_exact(len, GFP_KERNEL);
+	if (!dj_reload.buf) {
+		printk(KERN_WARNING "dj_reload: no %lu KiB to keep aside\n",
+		       len / 1024);
+		return -ENOMEM;
+	}
+	dj_reload.len = len;
+	printk(KERN_INFO "dj_reload: %lu KiB at %p for reloads\n",
+	       len / 1024, dj_reload.buf);
+	return 0;
+}
+
+core_initcall(dj_reload_reserve);
+
+static int __init dj_reload_init(void)
+{
+	if (!dj_reload.buf)
+		return -ENOMEM;
+	return misc_register(&dj_reload_dev);
+}
+
+device_initcall(dj_reload_init);
+
+/***************************************************************************/
@@ -29,6 +29,7 @@
 /***************************************************************************/
 
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/init.h>
 #include <linux/sched.h>
 #include <linux/interrupt.h>
@@ -42,6 +43,7 @@
 #include <asm/dj/djio.h>
 #include <asm/dj/timer.h>
 #include <asm/dj/irq.h>
+#include <asm/dj/boottrace.h>
 
 
 /***************************************************************************/
@@ -84,10 +86,14 @@ static inline int dj_timer_irq_to_idx(int irq) {
  * @tidx: The index of the corresponding timer, 0 to 4.
  * @enab: Zero to disable, nonzero to enable
  *
+ * The register is shared by all five, so this is safe to call with
+ * interrupts on, for anything else driving a spare timer.
  */
-static inline void dj_timer_frob_enab(int tidx, int enab) {
+void dj_timer_frob_enab(int tidx, int enab) {
+	unsigned long flags;
 	u16 tmp;
 
+	local_irq_save(flags);
 	tmp = readw(DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ENAB);
 	if (enab) {
 		tmp |=  (1 << tidx);
@@ -95,7 +101,9 @@ static inline void dj_timer_frob_enab(int tidx, int enab) {
 		tmp &= ~(1 << tidx);
 	}
 	writew(tmp, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ENAB);
+	local_irq_restore(flags);
 }
+EXPORT_SYMBOL(dj_timer_frob_enab);
 
 
 /***************************************************************************/
@@ -190,24 +198,16 @@ static irqreturn_t dj_timer_tick(int irq, void *dummy)
 	struct clock_event_device *evt = NULL;
 	int tidx = dj_timer_irq_to_idx(irq);
 
-#if 0
-	/* Since we are IRQF_DISABLED we don't need to do this: */
-	writeb(DJIO_A_IRQ_GLOBAL_DISABLE, DJIO_A_IRQ_GLOBAL);
-	writeb(0, DJIO_A_IRQ_N(irq - DJIO_IRQ_BASE));
-	writeb(DJIO_A_IRQ_GLOBAL_ENABLE,  DJIO_A_IRQ_GLOBAL);
-#endif	
-
-	/* No clue here.  Should we clear ACKs before or after handler? */
+	/*
+	 * The source is acked first, so the controller's eoi after we
+	 * return finds it quiet.  The handler may program the next shot.
+	 */
 	writew(((u16)1) << tidx, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ACK);
 		
 	evt = dj_clock_event_devices[tidx];
 	if (evt)
 		evt->event_handler(evt);
 
-	writeb(DJIO_A_IRQ_GLOBAL_DISABLE, DJIO_A_IRQ_GLOBAL);
-	writeb(2, DJIO_A_IRQ_N(irq - DJIO_IRQ_BASE));
-	writeb(DJIO_A_IRQ_GLOBAL_ENABLE,  DJIO_A_IRQ_GLOBAL);
-
 	return IRQ_HANDLED;
 }
 
@@ -271,11 +271,73 @@ static struct clocksource dj_timer_clk = {
 
 /***************************************************************************/
 
+/**
+ * dj_timer_quiesce: stop all five countdown timers, and their IRQs
+ *
+ * For handing the machine to another kernel (platform/dj/reload.c),
+ * whose hw_timer_init() expects to find them as the ROM leaves them.
+ * The free running counter is left alone.
+ */
+void dj_timer_quiesce(void)
+{
+	int tidx;
+
+	for (tidx = 0; tidx < 5; tidx++) {
+		writew(0, ((u16 *)(DJIO_A_TIMER + DJIO_A_TIMER_A_SHOT)) + tidx);
+		writew(0, ((u16 *)(DJIO_A_TIMER + DJIO_A_TIMER_A_PERIOD)) + tidx);
+	}
+	writew(0, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ENAB);
+	writew(0x1f, DJIO_A_TIMER + DJIO_A_TIMER_IRQ_ACK);
+}
+
+/***************************************************************************/
+
+unsigned int dj_boottrace_romdiv;
+
+/**
+ * dj_timer_counter_div: the divider the free running counter runs at
+ *
+ * Straight from the prescaler, so before hw_timer_init() this is
+ * whatever the ROM left there.  A 0 in the field counts as 32 (see
+ * asm/dj/timer.h), which is also what a ROM that never wrote it leaves.
+ */
+unsigned int dj_timer_counter_div(void)
+{
+	unsigned int div = readb(DJIO_A_TIMER + DJIO_A_TIMER_COUNTER_DIV) &
+		DJIO_A_TIMER_COUNTER_DIV_MASK;
+
+	return div ? div : 32;
+}
+
+/**
+ * dj_timer_head_report: say how long head.S took over its loops
+ *
+ * From dj_boottrace_stamps, at whatever rate the ROM left the counter
+ * running, so hw_timer_init() calls it before it sets our own.  The
+ * rate is kept for platform/dj/boottrace.c too.
+ */
+static void dj_timer_head_report(void)
+{
+	unsigned long *t = dj_boottrace_stamps;
+	unsigned int div;
+
+	dj_boottrace(DJ_BT_TIMER);
+	div = dj_boottrace_romdiv = dj_timer_counter_div();
+
+	printk(KERN_INFO "dj: head.S: ROMFS copy %lu us, bss clear %lu us; "
+	       "start_kernel after %lu us, time_init after %lu us\n",
+	       DJ_CLICKS_TO_US(t[DJ_BT_ROMFS] - t[DJ_BT_SETUP], div),
+	       DJ_CLICKS_TO_US(t[DJ_BT_KERNEL] - t[DJ_BT_ROMFS], div),
+	       DJ_CLICKS_TO_US(t[DJ_BT_KERNEL] - t[DJ_BT_SETUP], div),
+	       DJ_CLICKS_TO_US(t[DJ_BT_TIMER] - t[DJ_BT_SETUP], div));
+}
+
 void hw_timer_init(void)
 {
 	int i;
 	struct clock_event_device *cevent;
 
+	dj_timer_head_report();
 	writeb(CONFIG_DJ_COUNTER_DIV & DJIO_A_TIMER_COUNTER_DIV_MASK, 
 	       DJIO_A_TIMER + DJIO_A_TIMER_COUNTER_DIV);
 	clocksource_register(&dj_timer_clk);
@@ -292,6 +354,8 @@ void hw_timer_init(void)
 		cevent->min_delta_ns = DJ_TIMER_MIN_DELTA_NS;
 
 		dj_timer_init(CLOCK_EVT_MODE_UNUSED, cevent);
+		/* IRQF_DISABLED and acked at the source: one eoi will do */
+		set_irq_handler(cevent->irq, handle_fasteoi_irq);
 		setup_irq(cevent->irq, &(dj_timer_irqs[i]));
 		clockevents_register_device(cevent);
 	}
@@ -0,0 +1,43 @@
+/***************************************************************************/
+
+/*
+ *	unpack.c -- Unpack the kernel image linked in behind us.
+ *
+ *	Copyright (C) 2010, Brian S. Julin <bri@abrij.org>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston MA 02111-1307, USA.
+ *
+ */
+
+/***************************************************************************/
+
+#include <asm/dj/lz.h>
+
+extern const unsigned char piggy_start[], piggy_end[];
+
+/*
+ * piggy_start is four bytes of unpacked length, then the packed stream.
+ * Everything from KERNELBASE up to our own copy is ours to unpack into.
+ * Returns 0 if the kernel is all there.
+ */
+int zboot_unpack(void)
+{
+	unsigned long len;
+
+	len = (unsigned long)piggy_start[0] << 24 | piggy_start[1] << 16 |
+		piggy_start[2] << 8 | piggy_start[3];
+	if (len > ZBOOT_BASE - KERNELBASE)
+		return -1;
+	return dj_lz_unpack(piggy_start + 4, piggy_end - piggy_start - 4,
+			    (unsigned char *)KERNELBASE, len) == len ? 0 : -1;
+}
@@ -61,6 +61,8 @@
 #include <linux/proc_fs.h>
 #include <linux/platform_device.h>
 #include <linux/clk.h>
+#include <linux/notifier.h>
+#include <linux/reboot.h>
 #include <linux/usb/ch9.h>
 #include <linux/usb/gadget.h>
 
@@ -72,6 +74,7 @@
 #include <asm/dj/djio.h>
 #include <asm/dj/usb.h>
 #include <asm/dj/irq.h>
+#include <asm/dj/boottrace.h>
 
 #define	NUM_ENDPOINTS	3
 
@@ -868,13 +871,15 @@ static irqreturn_t djcf_udc_irq (int irq, void *unused)
 	u32			rescans = 4;
 	u8			irqsrc;
 	u8			irq_mask;
-	unsigned long flags;
 
-	local_irq_save(flags);
-	/* Turn off IRQs at the source */
+	/*
+	 * No local_irq_save: our line stays masked until we return, and
+	 * no other handler touches the UDC, so there's nothing to keep
+	 * the tick and the motion lines waiting for a whole pass over
+	 * (see platform/dj/irq.c).
+	 */
+	/* Turn off IRQs at the source; platform/dj/irq.c does the line */
 	irq_mask = mask_irqs(&djudc, 0);
-	/* Ack the line */
-	writeb(2, DJIO_A_IRQ_N(DJIO_A_USB_IRQA_LINE));
 	/* Figure out what caused the irq. */
 	irqsrc = readb(DJIO_A_USB + DJIO_A_USB_IRQA_ACK);
 	/* Ack the source */
@@ -910,7 +915,6 @@ static irqreturn_t djcf_udc_irq (int irq, void *unused)
 
  leave:
 	mask_irqs(&djudc, irq_mask);
-	local_irq_restore(flags);
 
 	return IRQ_HANDLED;
 }
@@ -954,6 +958,7 @@ int usb_gadget_register_driver(struct usb_gadget_driver *driver)
 	}
 
 	DBG("bound to %s\n", driver->driver.name);
+	dj_boottrace(DJ_BT_BIND);
 
 	/* IRQ will fire to start us up */
 	djudc.int_mask = 0xff;
@@ -991,16 +996,41 @@ static struct irqaction djcf_udc_irqaction = {
 	.handler = djcf_udc_irq,
 };
 
+/*
+ * Nothing here has a shutdown method for a restart to call, and a warm
+ * reload (platform/dj/reload.c) must not have the UDC interrupting the
+ * new kernel before it has a handler for it.  So mask and ack it all.
+ */
+static int djcf_udc_reboot(struct notifier_block *nb, unsigned long event,
+			   void *unused)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	djudc.enabled = 0;
+	mask_irqs(&djudc, 0);
+	writeb(0xff, DJIO_A_USB + DJIO_A_USB_IRQA_ACK);
+	local_irq_restore(flags);
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block djcf_udc_reboot_nb = {
+	.notifier_call = djcf_udc_reboot,
+};
+
 static int __init udc_init_module(void)
 {
+	dj_boottrace(DJ_BT_UDC);
 	setup_irq(DJIO_IRQ_BASE + DJIO_A_USB_IRQA_LINE, &djcf_udc_irqaction);
 	device_register(&djudc.gadget.dev);
+	register_reboot_notifier(&djcf_udc_reboot_nb);
 	return 0;
 }
 module_init(udc_init_module);
 
 static void __exit udc_exit_module(void)
 {
+	unregister_reboot_notifier(&djcf_udc_reboot_nb);
 	device_unregister(&djudc.gadget.dev);
 	remove_irq(DJIO_IRQ_BASE + DJIO_A_USB_IRQA_LINE, &djcf_udc_irqaction);
 }
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+/*
+ * The addx csum_partial and csum_partial_copy_nocheck in
+ * platform/dj/checksum.S against arch/m68knommu/lib/checksum.c's C,
+ * first checked to give exactly what the C does on random buffers of
+ * every length to CHECK_LEN at every alignment, then timed in cycles
+ * a byte at the core clock given with -f (or just MB/s without it).
+ * As a flat binary, for the printer or for qemu:
+ *
+ *   m68k-uclinux-gcc -mcpu=5206 -O2 -Wl,-elf2flt -DDJ_CSUM_BENCH -o csumbench \
+ *     csumbench.c ../linux-2.6.x/arch/m68knommu/platform/dj/checksum.S
+ *   qemu-m68k -cpu cfv4e ./csumbench
+ *
+ * or with m68k-linux-gnu-gcc -static and "qemu-m68k -cpu any".  qemu's
+ * numbers say which is less work, not how fast the printer does it.
+ * Built for anything else, the C stands in for the assembler so the
+ * harness itself can be tried out.
+ */
+
+/* Largest buffer timed, and the slack either side for alignment and guards */
+#define MAX_LEN 16384
+#define SLACK 64
+#define GUARD 0xa5
+/* Lengths checked exhaustively, at every alignment */
+#define CHECK_LEN 300
+/* Random buffers checked on top of those */
+#define CHECK_RANDOM 20000
+
+typedef unsigned int u32;
+
+typedef u32 (*csum_fn) (const void *buff, int len, u32 sum);
+typedef u32 (*copy_fn) (const void *src, void *dst, int len, u32 sum);
+
+/*
+ * arch/m68knommu/lib/checksum.c, less the __force and __wsum, and
+ * unsigned int for its unsigned long so it runs the same anywhere.
+ */
+static inline unsigned short from32to16 (u32 x) {
+  /* add up 16-bit and 16-bit for 16+c bit */
+  x = (x & 0xffff) + (x >> 16);
+  /* add up carry.. */
+  x = (x & 0xffff) + (x >> 16);
+  return x;
+}
+
+static u32 do_csum (const unsigned char *buff, int len) {
+  int odd, count;
+  u32 result = 0;
+
+  if (len <= 0) goto out;
+  odd = 1 & (unsigned long) buff;
+  if (odd) {
+    result = *buff;			/* big endian */
+    len--;
+    buff++;
+  }
+  count = len >> 1;			/* nr of 16-bit words.. */
+  if (count) {
+    if (2 & (unsigned long) buff) {
+      result += *(unsigned short *) buff;
+      count--;
+      len -= 2;
+      buff += 2;
+    }
+    count >>= 1;			/* nr of 32-bit words.. */
+    if (count) {
+      u32 carry = 0;
+      do {
+	u32 w = *(u32 *) buff;
+	count--;
+	buff += 4;
+	result += carry;
+	result += w;
+	carry = (w > result);
+      } while (count);
+      result += carry;
+      result = (result & 0xffff) + (result >> 16);
+    }
+    if (len & 2) {
+      result += *(unsigned short *) buff;
+      buff += 2;
+    }
+  }
+  if (len & 1)
+    result += (*buff << 8);		/* big endian */
+  result = from32to16(result);
+  if (odd)
+    result = ((result >> 8) & 0xff) | ((result & 0xff) << 8);
+out:
+  return result;
+}
+
+static u32 lib_csum_partial (const void *buff, int len, u32 sum) {
+  u32 result = do_csum(buff, len);
+
+  /* add in old sum, and carry.. */
+  result += sum;
+  if (sum > result)
+    result += 1;
+  return result;
+}
+
+static u32 lib_csum_partial_copy_nocheck (const void *src, void *dst, int len,
+					  u32 sum) {
+  memcpy(dst, src, len);
+  return lib_csum_partial(dst, len, sum);
+}
+
+#ifdef __m68k__
+extern u32 dj_csum_partial (const void *buff, int len, u32 sum);
+extern u32 dj_csum_partial_copy_nocheck (const void *src, void *dst, int len,
+					 u32 sum);
+extern unsigned short dj_ip_fast_csum (const void *iph, unsigned int ihl);
+#else
+#define dj_csum_partial lib_csum_partial
+#define dj_csum_partial_copy_nocheck lib_csum_partial_copy_nocheck
+static unsigned short dj_ip_fast_csum (const void *iph, unsigned int ihl) {
+  return ~do_csum(iph, ihl * 4);
+}
+#endif
+
+static const struct {
+  const char *name;
+  csum_fn csum;
+  copy_fn copy;
+} impls[] = {
+  { "lib", lib_csum_partial, lib_csum_partial_copy_nocheck },
+  { "addx", dj_csum_partial, dj_csum_partial_copy_nocheck },
+};
+#define NIMPLS (sizeof(impls) / sizeof(*impls))
+
+/* 20 and 40 for headers, 576 and 1500 for whole packets */
+static const int lens[] = { 20, 40, 64, 256, 576, 1500, 4096, MAX_LEN };
+#define NLENS (sizeof(lens) / sizeof(*lens))
+
+/* Destination and source offsets from a long word */
+static const struct { int dst, src; } aligns[] = {
+  { 0, 0 }, { 2, 2 }, { 1, 1 }, { 0, 2 }, { 0, 1 },
+};
+#define NALIGNS (sizeof(aligns) / sizeof(*aligns))
+
+static unsigned char srcbuf[MAX_LEN + 2 * SLACK] __attribute__ ((aligned (16)));
+static unsigned char dstbuf[MAX_LEN + 2 * SLACK] __attribute__ ((aligned (16)));
+
+static unsigned long long mono_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*****************************************************************************/
+
+static unsigned seed = 1;
+
+static u32 rnd (void) {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+/* Random bytes, or now and then all 0xff or all 0, to push the carries */
+static void fill (unsigned char *p, size_t n) {
+  switch (rnd() % 8) {
+  case 0:
+    memset(p, 0xff, n);
+    break;
+  case 1:
+    memset(p, 0, n);
+    break;
+  default:
+    while (n--) *p++ = rnd();
+  }
+}
+
+static int check_one (int impl, int len, int doff, int soff) {
+  unsigned char *s = srcbuf + SLACK + soff, *d = dstbuf + SLACK + doff;
+  u32 sum = rnd() % 4 ? rnd() : rnd() % 2 ? 0 : 0xffffffff;
+  u32 want, got;
+  int i;
+
+  fill(srcbuf, sizeof(srcbuf));
+  want = lib_csum_partial(s, len, sum);
+  got = impls[impl].csum(s, len, sum);
+  if (got != want) {
+    fprintf(stderr, "%s csum_partial wrong: %i bytes at +%i, sum %08x: "
+	    "%08x, not %08x\n", impls[impl].name, len, soff, sum, got, want);
+    return -1;
+  }
+  /* The C sums what it copied, so give it the same destination */
+  memset(dstbuf, GUARD, sizeof(dstbuf));
+  want = lib_csum_partial_copy_nocheck(s, d, len, sum);
+  memset(dstbuf, GUARD, sizeof(dstbuf));
+  got = impls[impl].copy(s, d, len, sum);
+  for (i = 0; i < SLACK + doff; i++)
+    if (dstbuf[i] != GUARD) break;
+  if (got != want || i != SLACK + doff || memcmp(d, s, len) ||
+      d[len] != GUARD) {
+    fprintf(stderr, "%s csum_partial_copy_nocheck wrong: %i bytes, "
+	    "dst +%i, src +%i%s\n", impls[impl].name, len, doff, soff,
+	    got != want ? "" : ", copied wrong");
+    return -1;
+  }
+  return 0;
+}
+
+static int check (void) {
+  int impl, len, doff, soff, i, bad = 0;
+  unsigned char *iph = srcbuf + SLACK;
+
+  for (impl = 0; impl < NIMPLS; impl++) {
+    for (len = 0; len < CHECK_LEN; len++)
+      for (doff = 0; doff < 4; doff++)
+	for (soff = 0; soff < 4; soff++)
+	  if (check_one(impl, len, doff, soff) && ++bad > 20) return -1;
+    for (i = 0; i < CHECK_RANDOM; i++)
+      if (check_one(impl, rnd() % (MAX_LEN + 1), rnd() % 4, rnd() % 4) &&
+	  ++bad > 20)
+	return -1;
+  }
+  for (i = 5; i < 16; i++) {
+    fill(iph, i * 4);
+    if (dj_ip_fast_csum(iph, i) != (unsigned short) ~do_csum(iph, i * 4)) {
+      fprintf(stderr, "ip_fast_csum wrong: %i long words\n", i);
+      bad++;
+    }
+  }
+  return bad ? -1 : 0;
+}
+
+/*****************************************************************************/
+
+/* ns a byte for checksumming about total bytes len at a time */
+static double bench_one (int impl, int copy, int len, int doff, int soff,
+			 unsigned long total) {
+  unsigned char *s = srcbuf + SLACK + soff, *d = dstbuf + SLACK + doff;
+  unsigned long reps = total / len, i;
+  unsigned long long t;
+  volatile u32 sink = 0;
+
+  if (!reps) reps = 1;
+  t = mono_ns();
+  if (copy)
+    for (i = 0; i < reps; i++) sink += impls[impl].copy(s, d, len, i);
+  else
+    for (i = 0; i < reps; i++) sink += impls[impl].csum(s, len, i);
+  t = mono_ns() - t;
+  return (double) t / ((double) reps * len);
+}
+
+static void bench (int copy, unsigned long total, double mhz) {
+  int a, impl, k;
+
+  printf("\n%s, %s\n%6s %4s %4s", copy ? "csum_partial_copy_nocheck" :
+	 "csum_partial", mhz ? "cycles/byte" : "MB/s", "len", "src",
+	 copy ? "dst" : "");
+  for (impl = 0; impl < NIMPLS; impl++) printf(" %9s", impls[impl].name);
+  printf("\n");
+  fill(srcbuf, sizeof(srcbuf));
+  for (k = 0; k < NLENS; k++)
+    for (a = 0; a < NALIGNS; a++) {
+      /* csum_partial has no destination, so only one of each source */
+      if (!copy && aligns[a].src != aligns[a].dst) continue;
+      printf("%6i %4i", lens[k], aligns[a].src);
+      if (copy) printf(" %4i", aligns[a].dst);
+      else printf(" %4s", "");
+      for (impl = 0; impl < NIMPLS; impl++) {
+	double ns = bench_one(impl, copy, lens[k], aligns[a].dst,
+			      aligns[a].src, total);
+
+	if (!ns) ns = 1e-9;
+	printf(" %9.2f", mhz ? ns * mhz / 1000.0 : 1000.0 / ns);
+      }
+      printf("\n");
+      fflush(stdout);
+    }
+}
+
+static void usage (const char *name) {
+  fprintf(stderr,
+	  "usage: %s [-m MB] [-f MHz] [-c]\n"
+	  "  -m, --megs MB   bytes summed per measurement (default 4)\n"
+	  "  -f, --mhz MHz   core clock, to give cycles a byte, not MB/s\n"
+	  "  -c, --check     only check the results, don't time them\n",
+	  name);
+}
+
+int main (int argc, char **argv)
+{
+  unsigned long total = 4UL << 20;
+  double mhz = 0;
+  int ret, only_check = 0;
+  static const struct option opts[] = {
+    { "megs", required_argument, NULL, 'm' },
+    { "mhz", required_argument, NULL, 'f' },
+    { "check", no_argument, NULL, 'c' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while ((ret = getopt_long(argc, argv, "m:f:ch", opts, NULL)) != -1) {
+    switch (ret) {
+    case 'm':
+      total = strtoul(optarg, NULL, 0) << 20;
+      if (!total) {
+	fprintf(stderr, "%s: at least a megabyte\n", argv[0]);
+	return 1;
+      }
+      break;
+    case 'f':
+      mhz = strtod(optarg, NULL);
+      if (mhz <= 0) {
+	fprintf(stderr, "%s: bad clock %s\n", argv[0], optarg);
+	return 1;
+      }
+      break;
+    case 'c':
+      only_check = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return ret == 'h' ? 0 : 1;
+    }
+  }
+  if (optind != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (check()) return 1;
+  printf("all %u checked against lib/checksum.c\n", (unsigned) NIMPLS);
+  if (only_check) return 0;
+  bench(0, total, mhz);
+  bench(1, total, mhz);
+  return 0;
+}
@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <ieee1284.h>
+
+/*
+ * Protocol and unpacker, shared with the loader:
+ *   gcc -O2 -I../linux-2.6.x/arch/m68k/include -o ecpboot ecpboot.c -lieee1284
+ */
+#include <asm/dj/ecpboot.h>
+#include <asm/dj/lz.h>
+#include <asm/dj/p1284.h>
+#include <asm/dj/reload.h>
+
+/* Give the ROM this long to jump into the loader before we negotiate */
+#define SETTLE_MS 200
+/* Resends of a block, and restarts from the header, before giving up */
+#define BLOCK_TRIES 5
+#define IMAGE_TRIES 3
+/* How long the loader gets to answer, in ECP reads of up to a second */
+#define STATUS_TRIES 5
+/* The packer's hash table, and how far back and how hard it looks */
+#define LZ_HASH_BITS 16
+#define LZ_WINDOW 65536
+#define LZ_CHAIN 256
+/* Bytes per S3 record that srec_cat writes, as runkernel used it */
+#define SREC_BYTES 32
+
+static unsigned long crctab[256];
+
+static unsigned long long mono_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void put32 (unsigned char *p, unsigned long v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void put16 (unsigned char *p, unsigned int v) {
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static char *read_file (const char *path, long *len) {
+  struct stat st;
+  char *buf;
+  FILE *f;
+
+  f = fopen(path, "r");
+  if (!f || fstat(fileno(f), &st)) {
+    perror(path);
+    if (f) fclose(f);
+    return NULL;
+  }
+  buf = malloc(st.st_size ? st.st_size : 1);
+  if (!buf || fread(buf, 1, st.st_size, f) != st.st_size) {
+    perror(path);
+    free(buf);
+    fclose(f);
+    return NULL;
+  }
+  fclose(f);
+  *len = st.st_size;
+  return buf;
+}
+
+/*
+ * Packing, in the format dj_lz_unpack() reads.  Greedy, taking the
+ * longest match of up to LZ_CHAIN earlier places with the same four
+ * bytes: unpacking costs the same however hard we look here, and every
+ * byte saved is one less down the cable.
+ */
+static unsigned char *lz_len (unsigned char *op, long len) {
+  for (; len >= 255; len -= 255) *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+static unsigned char *lz_seq (unsigned char *op, const unsigned char *lit,
+			      long nlit, long off, long mlen) {
+  unsigned char *token = op++;
+
+  *token = (nlit < 15 ? nlit : 15) << 4;
+  if (nlit >= 15) op = lz_len(op, nlit - 15);
+  memcpy(op, lit, nlit);
+  op += nlit;
+  if (!mlen) return op;
+  *op++ = off;
+  *op++ = off >> 8;
+  mlen -= DJ_LZ_MINMATCH;
+  *token |= mlen < 15 ? mlen : 15;
+  if (mlen >= 15) op = lz_len(op, mlen - 15);
+  return op;
+}
+
+/* Hash chains: head[] per hash of four bytes, prev[] back from each one */
+static long lz_head[1 << LZ_HASH_BITS], lz_prev[LZ_WINDOW];
+
+static void lz_insert (const unsigned char *src, long i) {
+  unsigned long h = ((unsigned long)src[i] << 24 | src[i + 1] << 16
+		     | src[i + 2] << 8 | src[i + 3]) * 2654435761UL;
+
+  h = (h & 0xffffffffUL) >> (32 - LZ_HASH_BITS);
+  lz_prev[i % LZ_WINDOW] = lz_head[h];
+  lz_head[h] = i;
+}
+
+static long lz_pack (const unsigned char *src, long len, unsigned char *dst) {
+  unsigned char *op = dst;
+  long i = 0, anchor = 0, ref, n, best, bestref = 0, depth;
+
+  for (n = 0; n < (1 << LZ_HASH_BITS); n++) lz_head[n] = -1;
+  while (i + DJ_LZ_MINMATCH <= len) {
+    lz_insert(src, i);
+    best = 0;
+    for (ref = lz_prev[i % LZ_WINDOW], depth = LZ_CHAIN;
+	 ref >= 0 && i - ref < LZ_WINDOW && depth--;
+	 ref = lz_prev[ref % LZ_WINDOW]) {
+      for (n = 0; i + n < len && src[ref + n] == src[i + n]; n++) { };
+      if (n > best) {
+	best = n;
+	bestref = ref;
+      }
+    }
+    if (best < DJ_LZ_MINMATCH) {
+      i++;
+      continue;
+    }
+    op = lz_seq(op, src + anchor, i - anchor, i - bestref, best);
+    /* What we matched over goes in the chains too */
+    for (n = 1; n < best && i + n + DJ_LZ_MINMATCH <= len; n++)
+      lz_insert(src, i + n);
+    i += best;
+    anchor = i;
+  }
+  op = lz_seq(op, src + anchor, len - anchor, 0, 0);
+  return op - dst;
+}
+
+/*
+ * The image as it goes on the wire: the header, then each block with
+ * its own header in front, every one unpacked again and checked first.
+ */
+struct image {
+  unsigned char hdr[ECPBOOT_HDR_LEN];
+  unsigned char *blk[(ECPBOOT_BASE - ECPBOOT_LOAD) / ECPBOOT_BLOCK + 1];
+  long blklen[(ECPBOOT_BASE - ECPBOOT_LOAD) / ECPBOOT_BLOCK + 1];
+  long nblk, size, packed;
+};
+
+static int image_pack (struct image *im, const unsigned char *raw, long size,
+		       unsigned long load, unsigned long entry) {
+  static unsigned char check[ECPBOOT_BLOCK];
+  unsigned char *b;
+  long n, rlen, plen;
+
+  if (load < ECPBOOT_LOAD || load + size > ECPBOOT_BASE
+      || entry < load || entry >= load + size) {
+    fprintf(stderr, "%#lx-%#lx won't fit between %#x and the loader at %#x,"
+	    " or entry %#lx isn't in it\n", load, load + size, ECPBOOT_LOAD,
+	    ECPBOOT_BASE, entry);
+    return -1;
+  }
+  im->size = size;
+  im->nblk = (size + ECPBOOT_BLOCK - 1) / ECPBOOT_BLOCK;
+  im->packed = 0;
+  put32(im->hdr, ECPBOOT_MAGIC);
+  put32(im->hdr + 4, load);
+  put32(im->hdr + 8, entry);
+  put32(im->hdr + 12, size);
+  put32(im->hdr + 16, im->nblk);
+  put32(im->hdr + 20, ecpboot_crc(crctab, 0, raw, size));
+  for (n = 0; n < im->nblk; n++) {
+    rlen = size - n * ECPBOOT_BLOCK;
+    if (rlen > ECPBOOT_BLOCK) rlen = ECPBOOT_BLOCK;
+    b = malloc(ECPBOOT_BLK_HDR_LEN + ECPBOOT_PACKED_MAX);
+    if (!b) return -1;
+    plen = lz_pack(raw + n * ECPBOOT_BLOCK, rlen, b + ECPBOOT_BLK_HDR_LEN);
+    if (plen > ECPBOOT_PACKED_MAX
+	|| dj_lz_unpack(b + ECPBOOT_BLK_HDR_LEN, plen, check, rlen) != rlen
+	|| memcmp(check, raw + n * ECPBOOT_BLOCK, rlen)) {
+      fprintf(stderr, "block %li doesn't unpack to what went in\n", n);
+      free(b);
+      return -1;
+    }
+    put32(b, n);
+    put16(b + 4, plen);
+    put16(b + 6, rlen);
+    put32(b + 8, ecpboot_crc(crctab, 0, b + ECPBOOT_BLK_HDR_LEN, plen));
+    im->blk[n] = b;
+    im->blklen[n] = ECPBOOT_BLK_HDR_LEN + plen;
+    im->packed += im->blklen[n];
+  }
+  return 0;
+}
+
+static void image_free (struct image *im) {
+  while (im->nblk) free(im->blk[--im->nblk]);
+}
+
+/* What runkernel would have sent for the same image, S0 to S7 */
+static long srec_size (long size) {
+  long full = size / SREC_BYTES, part = size % SREC_BYTES;
+
+  return 71 + full * (15 + 2 * SREC_BYTES) + (part ? 15 + 2 * part : 0) + 26;
+}
+
+/*
+ * --pack: the whole image as one stream, for platform/dj/zboot to link
+ * in and unpack itself.  Four bytes of unpacked length, big-endian, then
+ * the packed bytes; one stream packs tighter than ECPBOOT_BLOCK pieces.
+ */
+static int pack_file (const char *path, const unsigned char *raw, long len) {
+  unsigned char *buf, *check;
+  long plen;
+  FILE *f;
+  int ret = -1;
+
+  buf = malloc(4 + len + len / 255 + 16);
+  check = malloc(len ? len : 1);
+  if (!buf || !check) goto out;
+  put32(buf, len);
+  plen = lz_pack(raw, len, buf + 4);
+  if (dj_lz_unpack(buf + 4, plen, check, len) != len
+      || memcmp(check, raw, len)) {
+    fprintf(stderr, "%s: doesn't unpack to what went in\n", path);
+    goto out;
+  }
+  if (!(f = fopen(path, "w"))) {
+    perror(path);
+    goto out;
+  }
+  if (fwrite(buf, 1, 4 + plen, f) != 4 + plen) {
+    perror(path);
+    fclose(f);
+    goto out;
+  }
+  if (fclose(f)) {
+    perror(path);
+    goto out;
+  }
+  printf("packed: %li bytes to %li (%.2fx), as S-records %li against %li\n",
+	 len, plen + 4, (double)len / (plen + 4), srec_size(plen + 4),
+	 srec_size(len));
+  ret = 0;
+ out:
+  free(buf);
+  free(check);
+  return ret;
+}
+
+/***************************************************************************/
+
+/* A loader that stops taking bytes for STATUS_TRIES timeouts is gone */
+static int ecp_write (struct parport *port, const unsigned char *p, long len) {
+  ssize_t ret;
+  int stalls = 0;
+
+  while (len) {
+    ret = ieee1284_ecp_write_data(port, 0, (const char *)p, len);
+    if (ret < 0 && ret != E1284_TIMEDOUT) return ret;
+    if (ret > 0) {
+      p += ret;
+      len -= ret;
+      stalls = 0;
+    } else if (++stalls == STATUS_TRIES) {
+      return E1284_TIMEDOUT;
+    }
+  }
+  return 0;
+}
+
+/* Turn the bus around for the loader's answer, and back.  Returns it. */
+static int ecp_status (struct parport *port) {
+  char c;
+  int i, ret = E1284_TIMEDOUT;
+
+  if ((ret = ieee1284_ecp_fwd_to_rev(port)) != E1284_OK) return ret;
+  for (i = 0; i < STATUS_TRIES; i++) {
+    ret = ieee1284_ecp_read_data(port, 0, &c, 1);
+    if (ret == 1 || (ret < 0 && ret != E1284_TIMEDOUT)) break;
+    ret = E1284_TIMEDOUT;
+  }
+  if (ieee1284_ecp_rev_to_fwd(port) != E1284_OK) return E1284_NEGFAILED;
+  return ret == 1 ? (unsigned char)c : ret;
+}
+
+/*
+ * Stage one: the loader, in compatibility mode as the ROM wants it.
+ * Returns how long that took in ns, or 0 if it failed.
+ */
+static unsigned long long send_loader (struct parport *port, const char *srec,
+				       long len) {
+  unsigned long long t0 = mono_ns();
+  ssize_t ret;
+
+  while (len) {
+    ret = ieee1284_compat_write(port, 0, srec, len);
+    if (ret < 0 && ret != E1284_TIMEDOUT) {
+      fprintf(stderr, "%s: compatibility write failed (%zi)\n", port->name, ret);
+      return 0;
+    }
+    if (ret > 0) {
+      srec += ret;
+      len -= ret;
+    }
+  }
+  return mono_ns() - t0 + 1;
+}
+
+/* Stage two: the packed image, over ECP.  Returns 0 once the loader says GO. */
+static int send_image (struct parport *port, const struct image *im) {
+  int tries, btries, st;
+  long n;
+
+  for (tries = 0; tries < IMAGE_TRIES; tries++) {
+    if (ecp_write(port, im->hdr, sizeof(im->hdr))) continue;
+    st = ecp_status(port);
+    if (st == ECPBOOT_FAIL) {
+      fprintf(stderr, "%s: the loader won't take this image\n", port->name);
+      return -1;
+    }
+    if (st != ECPBOOT_ACK) continue;
+    for (n = 0; n < im->nblk; n++) {
+      for (btries = 0; btries < BLOCK_TRIES; btries++) {
+	st = ecp_write(port, im->blk[n], im->blklen[n]);
+	if (!st) st = ecp_status(port);
+	if (st != ECPBOOT_NAK) break;
+	fprintf(stderr, "%s: block %li resent\n", port->name, n);
+      }
+      if (st != ECPBOOT_ACK) break;
+      fprintf(stderr, "\r%li/%li blocks", n + 1, im->nblk);
+    }
+    fprintf(stderr, "\n");
+    if (n < im->nblk) {
+      fprintf(stderr, "%s: lost the loader at block %li, starting over\n",
+	      port->name, n);
+      continue;
+    }
+    st = ecp_status(port);
+    if (st == ECPBOOT_GO) return 0;
+    fprintf(stderr, "%s: image CRC mismatch, starting over\n", port->name);
+  }
+  return -1;
+}
+
+/*
+ * Warm reload: no ROM and no loader, just the image with the header
+ * asm/dj/reload.h wants, for a running kernel to take and start.
+ */
+static unsigned char *warm_wrap (const unsigned char *raw, long len,
+				 unsigned long load, unsigned long entry) {
+  unsigned char *buf = malloc(DJ_RELOAD_HDR_LEN + len);
+
+  if (!buf) {
+    perror("malloc");
+    return NULL;
+  }
+  put32(buf, DJ_RELOAD_MAGIC);
+  put32(buf + 4, load);
+  put32(buf + 8, entry);
+  put32(buf + 12, len);
+  put32(buf + 16, ecpboot_crc(crctab, 0, raw, len));
+  memcpy(buf + DJ_RELOAD_HDR_LEN, raw, len);
+  return buf;
+}
+
+/* For some other way there, such as /dev/djreload over ttyGS0 */
+static int warm_file (const char *path, const unsigned char *buf, long len) {
+  FILE *f = strcmp(path, "-") ? fopen(path, "w") : stdout;
+
+  if (!f || fwrite(buf, 1, len, f) != len || (f != stdout && fclose(f))) {
+    perror(path);
+    return -1;
+  }
+  if (f == stdout) fflush(f);
+  return 0;
+}
+
+/*
+ * Over ECP, on the reload channel, and back to the console after so
+ * ecprxtx without -c finds it where it expects.  Nothing comes back on
+ * the reload channel; the kernel says how it went in its log.
+ */
+static int send_warm (struct parport *port, const unsigned char *buf,
+		      long len) {
+  char ch = DJ_P1284_CMD_CHAN | DJ_P1284_CH_RELOAD;
+  int ret;
+
+  if (ieee1284_ecp_write_addr(port, 0, &ch, 1) != 1) {
+    fprintf(stderr, "%s: kernel isn't taking ECP addresses\n", port->name);
+    return -1;
+  }
+  ret = ecp_write(port, buf, len);
+  ch = DJ_P1284_CMD_CHAN | DJ_P1284_CH_CONSOLE;
+  ieee1284_ecp_write_addr(port, 0, &ch, 1);
+  if (ret) fprintf(stderr, "%s: kernel stopped taking the image (%i)\n",
+		   port->name, ret);
+  return ret;
+}
+
+static void report (const struct image *im, long loaderlen,
+		    unsigned long long loader_ns, unsigned long long image_ns) {
+  long old = srec_size(im->size);
+  double rate;
+
+  printf("image:  %li bytes in %li blocks, packed to %li (%.2fx)\n",
+	 im->size, im->nblk, im->packed, (double)im->size / im->packed);
+  printf("wire:   %li bytes of loader S-records and %li of ECP, "
+	 "against %li of S-records\n", loaderlen, im->packed, old);
+  if (!loader_ns) return;
+  rate = loaderlen * 1e9 / loader_ns;
+  printf("time:   loader %.2fs at %.0f B/s, image %.2fs at %.0f B/s\n",
+	 loader_ns / 1e9, rate, image_ns / 1e9, im->packed * 1e9 / image_ns);
+  printf("        S-records all the way would have taken about %.1fs\n",
+	 old / rate);
+}
+
+static void usage (const char *name) {
+  fprintf(stderr,
+	  "usage: %s [-l FILE] [-a ADDR] [-e ADDR] [-n] linux.bin\n"
+	  "       %s -z FILE image.bin\n"
+	  "       %s -w [-o FILE] [-a ADDR] [-e ADDR] zImage.bin\n"
+	  "  -l, --loader FILE  stage one S-records (default ecpboot.srec,\n"
+	  "                     from arch/m68knommu/platform/dj/ecpboot)\n"
+	  "  -a, --load ADDR    where linux.bin goes (default %#x)\n"
+	  "  -e, --entry ADDR   where to jump into it (default the load address)\n"
+	  "  -n, --dry-run      pack and check the image, report sizes, and\n"
+	  "                     don't touch a port\n"
+	  "  -z, --pack FILE    just pack image.bin into FILE for\n"
+	  "                     arch/m68knommu/platform/dj/zboot, and exit\n"
+	  "  -w, --warm         hand the image to the running kernel to\n"
+	  "                     start instead (CONFIG_DJ_RELOAD); no power\n"
+	  "                     cycle, no ROM, no loader\n"
+	  "  -o, --output FILE  with -w, write it to FILE (- for stdout)\n"
+	  "                     instead, for /dev/djreload on the device\n",
+	  name, name, name, ECPBOOT_LOAD);
+}
+
+int main (int argc, char **argv)
+{
+  static struct image im;
+  struct parport_list pl;
+  struct parport *port;
+  struct timeval to;
+  const char *loaderpath = "ecpboot.srec", *packpath = NULL, *output = NULL;
+  unsigned long load = ECPBOOT_LOAD, entry = 0;
+  unsigned long long t0, loader_ns, image_ns;
+  char *raw, *loader = NULL;
+  unsigned char *wrapped = NULL;
+  long rawlen, loaderlen = 0;
+  int ret, dryrun = 0, warm = 0, cap;
+  static const struct option opts[] = {
+    { "loader", required_argument, NULL, 'l' },
+    { "load", required_argument, NULL, 'a' },
+    { "entry", required_argument, NULL, 'e' },
+    { "dry-run", no_argument, NULL, 'n' },
+    { "pack", required_argument, NULL, 'z' },
+    { "warm", no_argument, NULL, 'w' },
+    { "output", required_argument, NULL, 'o' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while ((ret = getopt_long(argc, argv, "l:a:e:nz:wo:h", opts, NULL)) != -1) {
+    switch (ret) {
+    case 'l':
+      loaderpath = optarg;
+      break;
+    case 'a':
+      load = strtoul(optarg, NULL, 0);
+      break;
+    case 'e':
+      entry = strtoul(optarg, NULL, 0);
+      break;
+    case 'n':
+      dryrun = 1;
+      break;
+    case 'z':
+      packpath = optarg;
+      break;
+    case 'w':
+      warm = 1;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return ret == 'h' ? 0 : 1;
+    }
+  }
+  if (optind != argc - 1 || (output && !warm)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (!entry) entry = load;
+
+  ecpboot_crc_init(crctab);
+  if (!(raw = read_file(argv[optind], &rawlen))) return 1;
+  if (packpath) {
+    ret = pack_file(packpath, (unsigned char *)raw, rawlen);
+    free(raw);
+    return ret ? 1 : 0;
+  }
+  if (warm) {
+    wrapped = warm_wrap((unsigned char *)raw, rawlen, load, entry);
+    free(raw);
+    if (!wrapped) return 1;
+    rawlen += DJ_RELOAD_HDR_LEN;
+    if (output || dryrun) {
+      ret = output ? warm_file(output, wrapped, rawlen) : 0;
+      free(wrapped);
+      return ret ? 1 : 0;
+    }
+    goto port;
+  }
+  ret = image_pack(&im, (unsigned char *)raw, rawlen, load, entry);
+  free(raw);
+  if (ret) return 1;
+  /* A dry run still counts the loader in, if there is one to count */
+  if (!(loader = read_file(loaderpath, &loaderlen)) && !dryrun) {
+    image_free(&im);
+    return 1;
+  }
+  if (dryrun) {
+    report(&im, loaderlen, 0, 0);
+    image_free(&im);
+    return 0;
+  }
+
+ port:
+
+  ieee1284_find_ports(&pl, 0);
+  if (pl.portc < 1) {
+    fprintf(stderr, "no parallel ports found\n");
+    ret = 1;
+    goto out;
+  }
+  port = pl.portv[0];
+  if (ieee1284_open(port, 0, &cap)) {
+    fprintf(stderr, "%s: inaccessible\n", port->name);
+    ret = 1;
+    goto out_ports;
+  }
+  if ((ret = ieee1284_claim(port))) {
+    fprintf(stderr, "%s: couldn't claim (%i)\n", port->name, ret);
+    goto out_close;
+  }
+  to.tv_sec = 1;
+  to.tv_usec = 0;
+  ieee1284_set_timeout(port, &to);
+
+  ret = 1;
+  if (warm) {
+    if (ieee1284_negotiate(port, M1284_ECP) != E1284_OK) {
+      fprintf(stderr, "%s: the kernel didn't take ECP\n", port->name);
+      goto out_release;
+    }
+    t0 = mono_ns();
+    if (!send_warm(port, wrapped, rawlen)) ret = 0;
+    image_ns = mono_ns() - t0 + 1;
+    ieee1284_terminate(port);
+    if (!ret)
+      printf("warm:   %li bytes in %.2fs at %.0f B/s\n", rawlen,
+	     image_ns / 1e9, rawlen * 1e9 / image_ns);
+    goto out_release;
+  }
+  if (!(loader_ns = send_loader(port, loader, loaderlen)))
+    goto out_release;
+  usleep(SETTLE_MS * 1000);
+  if (ieee1284_negotiate(port, M1284_ECP) != E1284_OK) {
+    fprintf(stderr, "%s: the loader didn't take ECP\n", port->name);
+    goto out_release;
+  }
+  t0 = mono_ns();
+  if (send_image(port, &im)) {
+    ieee1284_terminate(port);
+    goto out_release;
+  }
+  image_ns = mono_ns() - t0 + 1;
+  ieee1284_terminate(port);
+  report(&im, loaderlen, loader_ns, image_ns);
+  ret = 0;
+
+ out_release:
+  ieee1284_release(port);
+ out_close:
+  ieee1284_close(port);
+ out_ports:
+  ieee1284_free_ports(&pl);
+ out:
+  free(loader);
+  free(wrapped);
+  image_free(&im);
+  return ret;
+}
@@ -1,157 +1,2388 @@
+#define _GNU_SOURCE	/* posix_openpt, cfmakeraw, memfd_create */
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 
 #include <ieee1284.h>
 
-#define TX_RING_SIZE 65536
+#define TX_RING_SIZE 65536	/* powers of two, and multiples of the page size */
 #define RX_RING_SIZE 65536
+/* Default per-call transfer sizes, and the range --adaptive works within */
 #define TX_CHUNK_SIZE 32
 #define RX_CHUNK_SIZE 255
-static char txring[TX_RING_SIZE];
-static char rxring[RX_RING_SIZE];
-static int txi, txj, rxi, rxj;
-
-
-int evloop (struct parport *port) {
-  int count;
-
- again:
-  txj &= TX_RING_SIZE - 1;
-  txi &= TX_RING_SIZE - 1;
-  rxj &= RX_RING_SIZE - 1;
-  rxi &= RX_RING_SIZE - 1;
-  if (txj < txi) {
-    count = TX_RING_SIZE - txi;
-    if (count > TX_CHUNK_SIZE) count = TX_CHUNK_SIZE;
-    goto txadvance;
-  }
-  if (txj > txi) {
-    count = txj - txi;
-    if (count > TX_CHUNK_SIZE) count = TX_CHUNK_SIZE;
-  txadvance:
-    count = ieee1284_ecp_write_data(port, F1284_NONBLOCK, 
-				    txring + txi, count);
-    if (count > 0) {
-      txi += count;
-    } else if (count < 0) {
-      fprintf(stderr,"ECP write failed\n");
-      return count;
-    }
-  }
-  if (rxj < rxi) {
-    count = RX_RING_SIZE - rxi;
-    goto rxadvance;
-  }
-  if (rxj > rxi) {
-    count = rxj - rxi;
-  rxadvance:
-    if (count > RX_CHUNK_SIZE) count = RX_CHUNK_SIZE;
-    count = write(fileno(stdout), rxring + rxi, count);
-    if (count > 0) {
-      rxi += count;
-    } else if (count < 0) {
-      fprintf(stderr,"tty write failed\n");
-      return count;
-    }
-  }
-  txj &= TX_RING_SIZE - 1;
-  txi &= TX_RING_SIZE - 1;
-  rxj &= RX_RING_SIZE - 1;
-  rxi &= RX_RING_SIZE - 1;
-  if (rxi > rxj) {
-    count = rxi - rxj;
-    goto rxaccrue;
-  }
-  if (rxi <= rxj) {
-    count = RX_RING_SIZE - rxj;
-  rxaccrue:
-    if (count > RX_CHUNK_SIZE) count = RX_CHUNK_SIZE;
-    ieee1284_ecp_fwd_to_rev(port);
-    count = ieee1284_ecp_read_data(port, F1284_NONBLOCK, 
-				   rxring + rxi, count);
-    if (count > 0) {
-      rxj += count;
-    } else if (count < 0) {
-      if (count != E1284_TIMEDOUT) {
-	fprintf(stderr,"ECP read failed\n");
-	return count;
-      }
+#define CHUNK_MIN 8
+#define CHUNK_MAX 4096
+#define CHUNK_GROW_STREAK 4	/* full calls in a row before doubling */
+/* Unless the IRQ alone says when, we poll on a timer, backing off when idle */
+#define POLL_MIN_MS 1
+#define POLL_MAX_MS 10
+/* Turn the bus around at least this often for whichever way waits */
+#define READ_OVERDUE_NS (POLL_MAX_MS * 1000000ULL)
+/* Latency probes: wait this long for the device to go quiet between them */
+#define LAT_QUIET_NS 50000000ULL
+#define LAT_TIMEOUT_NS 2000000000ULL
+#define LAT_BENCH_PROBES 100
+#define LAT_MAX 1000000		/* -l: over half a day at the quiet time */
+/* --bench: settle time around shell commands, and give-up time */
+#define BENCH_QUIET_NS 300000000ULL
+#define BENCH_STALL_NS 5000000000ULL
+#define BENCH_KIB_MAX 4194303	/* -b: keeps the byte count under 4 GiB */
+/* --ring-bench: bytes the device side moves between console syscalls */
+#define RING_BENCH_BATCH 16000
+/*
+ * ECP channels, with -c: a command byte of CH_ADDR | n switches the
+ * data after it to channel n.  Same numbers as the device's
+ * asm/dj/p1284.h.  Bulk gets CH_BULK_BURST bytes per loop pass before
+ * the console fds are looked at again.
+ */
+enum { CH_CONSOLE, CH_BULK, CH_KLOG, NCHAN };
+#define CH_ADDR 0x80
+#define CH_BULK_BURST 256
+/*
+ * ECP run length encoding, with -e: a command byte n with bit 7 clear
+ * says the data byte after it stands for n + 1 copies.  Shorter runs
+ * than RLE_MIN go as they are, since the count costs a byte of its own.
+ */
+#define RLE_MIN 3
+#define RLE_MAX 128
+#define RLE_BENCH_SIZE (256 * 1024)
+/* Trace files, and how many mismatched calls replay puts up with */
+#define TRACE_MAGIC "ECPTRACE"
+#define TRACE_VERSION 1
+#define REPLAY_STUCK 1000
+/*
+ * The simulated peripheral: the DJ console as dj_p1284_console_putc()
+ * drives it, on the DJ895C's 5206 at its CONFIG_CLOCK_FREQ of 10 MHz.
+ * Each byte back to the host is a reverse request handshake of four
+ * status phases and then the 5000 pass spin the device does after every
+ * byte, a subq/bne pair of about 4 clocks a pass.  Handshake phases and
+ * turnarounds go at the bus's pace; the device's own work is in clocks.
+ */
+#define SIM_FIFO 16			/* ECP FIFO depth, each way */
+#define SIM_OUTQ 4096			/* device tty output buffer */
+#define SIM_CLOCK_HZ 10000000ULL
+#define SIM_CLOCKS_NS(n) ((n) * 1000000000ULL / SIM_CLOCK_HZ)
+#define SIM_PHASE_NS 1000ULL		/* one handshake phase */
+#define SIM_SPIN_NS SIM_CLOCKS_NS(4)	/* one pass of the trailing spin */
+#define SIM_PUTC_NS (4 * SIM_PHASE_NS + 5000 * SIM_SPIN_NS)
+#define SIM_RX_NS SIM_CLOCKS_NS(165)	/* device CPU per forward byte, echo included */
+#define SIM_TURN_NS 10000ULL		/* bus turnaround either way */
+/*
+ * Per-direction transfer size.  With --adaptive a call that moves the
+ * whole chunk CHUNK_GROW_STREAK times running doubles it, and a call
+ * that comes back short (timeout, device out of data or buffer) halves
+ * it, but never below what that call actually managed.
+ */
+struct chunk {
+  const char *name;
+  int size;
+  int adaptive;
+  int streak;
+  int lo, hi;			/* range visited, for the report */
+  unsigned long calls, shorts;
+  unsigned long long bytes;
+};
+
+/*
+ * Byte ring.  Where the kernel lets us, the same pages are mapped twice
+ * back to back, so whatever is queued (or free) from any offset is one
+ * contiguous span and nothing ever has to be split at the wrap.  If that
+ * fails we get a plain buffer and the tty side uses readv/writev to
+ * cover the wrap in one call; only the ECP side still splits there.
+ */
+struct ring {
+  char *buf;
+  unsigned int size;
+  int mirrored;
+  /* Free running indices: i is where data is drained, j where it is added */
+  unsigned int i, j;
+};
+
+/* A channel besides the console: where it comes from and goes to */
+struct stream {
+  int in, out;			/* -1 for none */
+  struct ring tx, rx;
+};
+
+struct link;
+
+/*
+ * What a link does to its port.  Normally these are straight libieee1284
+ * calls, but --transport can put a socketpair or PTY loopback or a
+ * simulated peripheral there instead, and --replay answers from a trace.
+ * The data calls return bytes moved or an E1284_* code, E1284_TIMEDOUT
+ * meaning nothing could move right now.
+ */
+struct transport {
+  const char *name;
+  int (*open) (struct link *l, int report);
+  void (*close) (struct link *l);
+  int (*negotiate) (struct link *l);
+  int (*write_data) (struct link *l, const char *buf, int len);
+  int (*read_data) (struct link *l, char *buf, int len);
+  int (*fwd_to_rev) (struct link *l);
+  /* One ECP command byte each way; E1284_NOTIMPL if there are none */
+  int (*write_addr) (struct link *l, char c);
+  int (*read_addr) (struct link *l, char *c);
+  /* Whether the peer is asking for the bus: 1, 0, or E1284_NOTIMPL */
+  int (*pending) (struct link *l);
+  int (*irq_fd) (struct link *l);	/* readable when the peer has news */
+  void (*clear_irq) (struct link *l);
+};
+
+/*
+ * Binary trace, in host byte order: a struct trace_hdr, then a struct
+ * trace_rec per event.  READ, RADDR, INPUT and BULKIN records are
+ * followed by their ret bytes of payload, which is what replay needs to
+ * reproduce the console; WRITE payloads are implied by the INPUT and
+ * BULKIN records before them.
+ */
+enum {
+  TR_WRITE = 1, TR_READ, TR_TURN, TR_INPUT, TR_WADDR, TR_RADDR, TR_BULKIN,
+  TR_DUE
+};
+struct trace_hdr {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+struct trace_rec {
+  uint32_t dt;			/* ns since the previous record, saturating */
+  uint8_t op;
+  uint8_t pad;
+  uint16_t len;			/* bytes asked for */
+  int32_t ret;			/* bytes moved, or an E1284_* code */
+};
+struct trace {
+  FILE *f;
+  unsigned long long last;	/* capture: when the previous record was */
+  struct trace_rec rec;		/* replay: the record up next... */
+  int have;			/* ...if this is set */
+  int left;			/* replay: its payload not handed out yet */
+  int stuck;			/* replay: calls it didn't answer */
+  unsigned long records, diverged, skipped;
+  unsigned long long span;	/* replay: capture time covered so far */
+};
+
+/*
+ * One ECP link: a port and the fds its console traffic comes from and
+ * goes to -- stdin/stdout normally, or a PTY master in daemon mode,
+ * where each link gets a thread of its own so that a stalled device
+ * only ever burns its own libieee1284 timeouts.
+ */
+struct link {
+  struct parport *port;
+  int hwirq;			/* libieee1284 offered the port's IRQ */
+  const char *name;
+  const struct transport *ops;
+  void *priv;			/* the transport's own state */
+  struct trace *cap;		/* --trace: where calls get recorded */
+  struct trace *replay;		/* --replay: where the port's answers come from */
+  int in, out;
+  int irqfd;
+  struct ring tx, rx;		/* the console */
+  struct chunk txchunk, rxchunk;
+  /* With -c, the other channels and which one each direction is on */
+  int channels;
+  int txch, rxch;
+  struct stream bulk, klog;
+  /* With -e; rlepend is a run whose count went out but its byte not */
+  int rle;
+  int rlepend;
+  /* Which way the bus is, and how often and how far it has gone */
+  int rev;
+  unsigned long long rxlast, txlast;
+  unsigned long turns;
+  unsigned long long moved;
+  /* Daemon mode: the PTY master and our own hold on its slave */
+  char ptyname[64];		/* empty without one */
+  int pty, ptyslave;
+  pthread_t thread;
+  int ret;
+};
+
+/* Chunk settings and -e from the command line, copied into every link */
+static struct chunk txchunk = { "tx", TX_CHUNK_SIZE };
+static struct chunk rxchunk = { "rx", RX_CHUNK_SIZE };
+static int rle;
+
+/*
+ * State for --latency: each probe is a newline, timed until the echo.
+ * This and --bench only ever run on a single stdin/stdout link.
+ */
+static struct {
+  int todo;			/* probes left to send */
+  int waiting;			/* a probe is in flight */
+  int done;			/* probes answered */
+  unsigned long long sent;	/* when the probe in flight was queued */
+  unsigned long long quiet;	/* when the device last sent us anything */
+  unsigned long long *samples;
+  int nsamples;
+} lat;
+
+/*
+ * State for --bench.  The device end is a busybox shell on the console,
+ * so we drive it with shell commands: echo off and cat to /dev/null to
+ * soak up the forward test, dd from /dev/zero for the reverse one, then
+ * latency probes, and finally echo back on.
+ */
+enum { BENCH_OFF, BENCH_SETUP, BENCH_TXWAIT, BENCH_TX, BENCH_RXWAIT,
+       BENCH_RX, BENCH_LAT, BENCH_DONE };
+static struct {
+  int phase;
+  unsigned int kib;
+  unsigned long long left;	/* payload still to queue or to receive */
+  unsigned long long t0, t1;
+  double txrate, rxrate;
+} bench;
+
+static unsigned long long mono_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void chunk_tune (struct chunk *c, int asked, int got) {
+  c->calls++;
+  if (got > 0) c->bytes += got;
+  if (got == asked) {
+    /* Only calls limited by the chunk size say anything about growing */
+    if (c->adaptive && asked == c->size && ++c->streak >= CHUNK_GROW_STREAK) {
+      c->streak = 0;
+      c->size *= 2;
+      if (c->size > CHUNK_MAX) c->size = CHUNK_MAX;
     }
-  }
-  /* TODO: select() here */
-  usleep(10000);
-  if (txi > txj) {
-    count = txi - txj;
-    goto txaccrue;
-  }
-  if (txi <= txj) {
-    count = TX_RING_SIZE - txj;
-  txaccrue:
-    if (count > TX_CHUNK_SIZE) count = TX_CHUNK_SIZE;
-    count = read(fileno(stdin), txring + txj, count);
-    if (count > 0) {
-      txj += count;
-    } else if (count < 0) {
-      if (errno != EAGAIN) {
-	perror("tty read failed: ");
-	return count;
-      }
+  } else {
+    c->shorts++;
+    c->streak = 0;
+    if (c->adaptive) {
+      c->size /= 2;
+      if (c->size < got) c->size = got;
+      if (c->size < CHUNK_MIN) c->size = CHUNK_MIN;
     }
   }
-  goto again;
+  if (c->size < c->lo || !c->lo) c->lo = c->size;
+  if (c->size > c->hi) c->hi = c->size;
 }
 
+/* How many bytes at p, out of len, are the same as the first */
+static int rle_run (const char *p, int len) {
+  int n;
 
+  if (len > RLE_MAX) len = RLE_MAX;
+  for (n = 1; n < len && p[n] == p[0]; n++) { };
+  return n;
+}
 
-int main ()
-{
-  struct parport *port;
-  struct parport_list pl;
-  unsigned int cap;
-  int ret;
-  struct timeval to;
+/* How many bytes at p can go as plain data before a run worth a count */
+static int rle_lit (const char *p, int len) {
+  int n, same = 1;
 
-  ret = fcntl(fileno(stdin),F_GETFL);
-  fcntl(fileno(stdin),F_SETFL,ret | O_NONBLOCK);
-  ret = fcntl(fileno(stdout),F_GETFL);
-  fcntl(fileno(stdout),F_SETFL,O_NONBLOCK);
-  ret = 0;
+  for (n = 1; n < len; n++) {
+    if (p[n] != p[n - 1])
+      same = 1;
+    else if (++same == RLE_MIN)
+      return n + 1 - RLE_MIN;
+  }
+  return len;
+}
+
+/* Map size bytes of a memfd twice, back to back, as the ring's buffer. */
+static int ring_mirror (struct ring *r, unsigned int size) {
+  char *base;
+  int fd;
+
+  fd = memfd_create("ecprxtx-ring", MFD_CLOEXEC);
+  if (fd < 0) return -1;
+  if (ftruncate(fd, size)) goto bail;
+  /* Reserve both halves first so nothing else can land in between */
+  base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) goto bail;
+  if (mmap(base, size, PROT_READ | PROT_WRITE,
+	   MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+      || mmap(base + size, size, PROT_READ | PROT_WRITE,
+	      MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(base, 2 * size);
+    goto bail;
+  }
+  close(fd);
+  r->buf = base;
+  r->mirrored = 1;
+  return 0;
+  bail:
+  close(fd);
+  return -1;
+}
+
+/* An empty ring, mirrored if asked and the kernel lets us. */
+static int ring_init (struct ring *r, unsigned int size, int mirror) {
+  r->size = size;
+  r->i = r->j = 0;
+  r->mirrored = 0;
+  if (mirror && !ring_mirror(r, size)) return 0;
+  r->buf = malloc(size);
+  if (!r->buf) {
+    perror("ring");
+    return -1;
+  }
+  return 0;
+}
+
+static void ring_free (struct ring *r) {
+  if (!r->buf) return;
+  if (r->mirrored)
+    munmap(r->buf, 2 * r->size);
+  else
+    free(r->buf);
+  r->buf = NULL;
+}
+
+static unsigned int ring_used (const struct ring *r) {
+  return r->j - r->i;
+}
+
+static unsigned int ring_room (const struct ring *r) {
+  return r->size - (r->j - r->i);
+}
+
+/* Contiguous queued bytes at the drain index. */
+static char *ring_rspan (const struct ring *r, int *len) {
+  unsigned int off = r->i & (r->size - 1);
+
+  *len = ring_used(r);
+  if (!r->mirrored && *len > r->size - off) *len = r->size - off;
+  return r->buf + off;
+}
+
+/* Contiguous free bytes at the fill index. */
+static char *ring_wspan (const struct ring *r, int *len) {
+  unsigned int off = r->j & (r->size - 1);
+
+  *len = ring_room(r);
+  if (!r->mirrored && *len > r->size - off) *len = r->size - off;
+  return r->buf + off;
+}
+
+/* Queued (fill == 0) or free (fill != 0) bytes as at most two iovecs. */
+static int ring_iov (const struct ring *r, struct iovec *iov, int fill) {
+  int len, total;
+
+  if (fill) {
+    total = ring_room(r);
+    iov[0].iov_base = ring_wspan(r, &len);
+  } else {
+    total = ring_used(r);
+    iov[0].iov_base = ring_rspan(r, &len);
+  }
+  iov[0].iov_len = len;
+  if (len == total) return len ? 1 : 0;
+  iov[1].iov_base = r->buf;
+  iov[1].iov_len = total - len;
+  return 2;
+}
+
+static struct trace *trace_open (const char *path, int capture) {
+  struct trace_hdr hdr;
+  struct trace *t;
+
+  t = calloc(1, sizeof(*t));
+  if (!t) {
+    perror("calloc");
+    return NULL;
+  }
+  t->f = fopen(path, capture ? "wb" : "rb");
+  if (!t->f) {
+    perror(path);
+    free(t);
+    return NULL;
+  }
+  setvbuf(t->f, NULL, _IOFBF, 65536);
+  if (capture) {
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    fwrite(&hdr, sizeof(hdr), 1, t->f);
+    t->last = mono_ns();
+  } else if (fread(&hdr, sizeof(hdr), 1, t->f) != 1
+	     || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic))
+	     || hdr.version != TRACE_VERSION) {
+    fprintf(stderr, "%s: not an ecprxtx trace\n", path);
+    fclose(t->f);
+    free(t);
+    return NULL;
+  }
+  return t;
+}
+
+static void trace_close (struct trace *t) {
+  if (fclose(t->f)) perror("trace");
+  free(t);
+}
+
+static void trace_log (struct trace *t, int op, int len, int ret,
+		       const char *data) {
+  struct trace_rec rec;
+  unsigned long long now = mono_ns();
 
-  txi = txj = rxi = rxj = 0;
+  rec.dt = (now - t->last > UINT32_MAX) ? UINT32_MAX : now - t->last;
+  rec.op = op;
+  rec.pad = 0;
+  rec.len = (len > 0xffff) ? 0xffff : len;
+  rec.ret = ret;
+  t->last = now;
+  fwrite(&rec, sizeof(rec), 1, t->f);
+  if (data && ret > 0) fwrite(data, 1, ret, t->f);
+  t->records++;
+}
+
+/* Log console input straight out of the ring it was read into. */
+static void trace_input (struct trace *t, int op, const struct ring *r,
+			 unsigned int from, int count) {
+  unsigned int off;
+  int len;
+
+  while (count > 0) {
+    off = from & (r->size - 1);
+    len = count;
+    if (!r->mirrored && len > r->size - off) len = r->size - off;
+    trace_log(t, op, len, len, r->buf + off);
+    from += len;
+    count -= len;
+  }
+}
+
+static int hw_open (struct link *l, int report) {
+  struct parport *port = l->port;
+  struct timeval to;
+  int cap, ret;
 
-  ieee1284_find_ports (&pl, 0);
-  port = pl.portv[0];
   to.tv_usec = 1000;
   to.tv_sec = 0;
   if (ieee1284_open (port, 0, &cap)) {
     fprintf (stderr, "%s: inaccessible\n", port->name);
-    ret = -1;
-    goto bail;
+    return -1;
   }
-  printf ("%s: %#lx", port->name, port->base_addr);
-  if (port->hibase_addr)
-    printf (" (ECR at %#lx)", port->hibase_addr);
-  printf ("\n  ");
-  if (ret = ieee1284_claim(port)) {
-    fprintf(stderr,"couldn't claim (%i)\n", ret);
+  if (report) {
+    printf ("%s: %#lx", port->name, port->base_addr);
+    if (port->hibase_addr)
+      printf (" (ECR at %#lx)", port->hibase_addr);
+    printf ("\n  ");
+  }
+  if ((ret = ieee1284_claim(port))) {
+    fprintf(stderr,"%s: couldn't claim (%i)\n", port->name, ret);
     perror("system errno: ");
-    goto bail1;
+    ieee1284_close(port);
+    return ret;
   }
+  l->hwirq = !!(cap & CAP1284_IRQ);
   ieee1284_set_timeout(port, &to);
   ieee1284_terminate(port);
-  if (ret = ieee1284_negotiate(port,M1284_ECP)) {
-    fprintf(stderr,"couldn't enter ECP mode (%i)\n", ret);
-    goto bail2;
-  } 
-  while (!(ret = evloop(port))) { };
-  bail2:
-  ieee1284_terminate(port);
+  return 0;
+}
+
+static void hw_close (struct link *l) {
+  ieee1284_terminate(l->port);
+  ieee1284_release(l->port);
+  ieee1284_close(l->port);
+}
+
+static int hw_negotiate (struct link *l) {
+  return ieee1284_negotiate(l->port, l->rle ? M1284_ECPRLE : M1284_ECP);
+}
+
+static int hw_irq_fd (struct link *l) {
+  return l->hwirq ? ieee1284_get_irq_fd(l->port) : -1;
+}
+
+static void hw_clear_irq (struct link *l) {
+  ieee1284_clear_irq(l->port, NULL);
+}
+
+static int hw_write_data (struct link *l, const char *buf, int len) {
+  return ieee1284_ecp_write_data(l->port, F1284_NONBLOCK, buf, len);
+}
+
+static int hw_read_data (struct link *l, char *buf, int len) {
+  return ieee1284_ecp_read_data(l->port, F1284_NONBLOCK, buf, len);
+}
+
+static int hw_fwd_to_rev (struct link *l) {
+  return ieee1284_ecp_fwd_to_rev(l->port);
+}
+
+static int hw_write_addr (struct link *l, char c) {
+  return ieee1284_ecp_write_addr(l->port, F1284_NONBLOCK, &c, 1);
+}
+
+/*
+ * libieee1284 stops a data read short at a channel address without
+ * taking it (run length counts it decodes itself, in ECPRLE mode),
+ * leaving the peripheral holding it out with PeriphClk low and its
+ * command flag up.  Only then is the address read worth doing:
+ * otherwise it would sit out the whole port timeout for nothing.
+ */
+static int hw_read_addr (struct link *l, char *c) {
+  int st = ieee1284_read_status(l->port);
+
+  if (st < 0) return st;
+  if ((st & S1284_NACK) || !(st & S1284_BUSY)) return E1284_TIMEDOUT;
+  /* A run length count is for the next data read, along with its byte */
+  if (!(ieee1284_read_data(l->port) & CH_ADDR)) return E1284_TIMEDOUT;
+  return ieee1284_ecp_read_addr(l->port, 0, c, 1);
+}
+
+/*
+ * PeriphRequest: while the bus is forward, platform/dj/p1284.c pulls
+ * nFault low for as long as it has anything queued for us.
+ */
+static int hw_pending (struct link *l) {
+  int st = ieee1284_read_status(l->port);
+
+  if (st < 0) return st;
+  return !(st & S1284_NFAULT);
+}
+
+static const struct transport hw_transport = {
+  "ieee1284", hw_open, hw_close, hw_negotiate,
+  hw_write_data, hw_read_data, hw_fwd_to_rev, hw_write_addr, hw_read_addr,
+  hw_pending, hw_irq_fd, hw_clear_irq
+};
+
+/*
+ * Loopback over a stream fd.  "loop" is a socketpair whose far end we
+ * turn straight round, so the device is an echo; "pty" is a PTY master
+ * whose slave some other program opens to play the device.  Both are
+ * always ready or not per the fd, so the fd doubles as the IRQ.
+ */
+struct loop_port {
+  int fd;			/* our end */
+  int peer;			/* the socketpair's far end, or the PTY slave */
+  int pump;			/* echo everything arriving at peer */
+};
+
+static void loop_pump (struct loop_port *lp) {
+  char buf[4096];
+  int n, m;
+
+  if (!lp->pump) return;
+  while ((n = recv(lp->peer, buf, sizeof(buf), MSG_PEEK)) > 0) {
+    m = send(lp->peer, buf, n, 0);
+    if (m <= 0) return;
+    recv(lp->peer, buf, m, 0);
+  }
+}
+
+static int loop_open (struct link *l, int report) {
+  struct loop_port *lp;
+  int sv[2];
+
+  lp = calloc(1, sizeof(*lp));
+  if (!lp) return -1;
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv)) {
+    perror("socketpair");
+    free(lp);
+    return -1;
+  }
+  lp->fd = sv[0];
+  lp->peer = sv[1];
+  lp->pump = 1;
+  l->priv = lp;
+  return 0;
+}
+
+static int pty_open (struct link *l, int report) {
+  struct loop_port *lp;
+  struct termios tio;
+  int fd;
+
+  lp = calloc(1, sizeof(*lp));
+  if (!lp) return -1;
+  fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0 || grantpt(fd) || unlockpt(fd) || !ptsname(fd)) {
+    perror("pty: ");
+    goto bail;
+  }
+  /* Held open so the master never sees HUP between device programs */
+  lp->peer = open(ptsname(fd), O_RDWR | O_NOCTTY);
+  if (lp->peer < 0) {
+    perror(ptsname(fd));
+    goto bail;
+  }
+  if (!tcgetattr(lp->peer, &tio)) {
+    cfmakeraw(&tio);
+    tcsetattr(lp->peer, TCSANOW, &tio);
+  }
+  fprintf(stderr, "pty: device side is %s\n", ptsname(fd));
+  lp->fd = fd;
+  l->priv = lp;
+  return 0;
+  bail:
+  if (fd >= 0) close(fd);
+  free(lp);
+  return -1;
+}
+
+static void loop_close (struct link *l) {
+  struct loop_port *lp = l->priv;
+
+  close(lp->fd);
+  close(lp->peer);
+  free(lp);
+}
+
+static int loop_negotiate (struct link *l) {
+  return E1284_OK;
+}
+
+static int loop_errno (void) {
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EIO)
+    return E1284_TIMEDOUT;	/* EIO: PTY slave not open by anyone */
+  return E1284_SYS;
+}
+
+static int loop_write_data (struct link *l, const char *buf, int len) {
+  struct loop_port *lp = l->priv;
+  int n;
+
+  n = write(lp->fd, buf, len);
+  if (n < 0) return loop_errno();
+  loop_pump(lp);
+  return n;
+}
+
+static int loop_read_data (struct link *l, char *buf, int len) {
+  struct loop_port *lp = l->priv;
+  int n;
+
+  loop_pump(lp);
+  n = read(lp->fd, buf, len);
+  if (n < 0) return loop_errno();
+  return n ? n : E1284_TIMEDOUT;
+}
+
+static int loop_fwd_to_rev (struct link *l) {
+  return E1284_OK;
+}
+
+/* A plain byte stream has nowhere to put commands */
+static int loop_write_addr (struct link *l, char c) {
+  return E1284_NOTIMPL;
+}
+
+static int loop_read_addr (struct link *l, char *c) {
+  return E1284_NOTIMPL;
+}
+
+/* Nor is there a bus to turn around, so reading is always fine */
+static int loop_pending (struct link *l) {
+  return E1284_NOTIMPL;
+}
+
+static int loop_irq_fd (struct link *l) {
+  return ((struct loop_port *)l->priv)->fd;
+}
+
+static void loop_clear_irq (struct link *l) {
+}
+
+static const struct transport loop_transport = {
+  "loop", loop_open, loop_close, loop_negotiate,
+  loop_write_data, loop_read_data, loop_fwd_to_rev, loop_write_addr,
+  loop_read_addr, loop_pending, loop_irq_fd, loop_clear_irq
+};
+
+static const struct transport pty_transport = {
+  "pty", pty_open, loop_close, loop_negotiate,
+  loop_write_data, loop_read_data, loop_fwd_to_rev, loop_write_addr,
+  loop_read_addr, loop_pending, loop_irq_fd, loop_clear_irq
+};
+
+/*
+ * Simulated peripheral, worked out lazily from the clock on every call
+ * rather than run as a thread.  Forward bytes land in the device's ECP
+ * FIFO, and the device takes them at SIM_RX_NS apiece and echoes them
+ * into its tty output like the console shell does.  That output only
+ * moves while the host has the link in reverse, one SIM_PUTC_NS
+ * handshake per byte, into a host FIFO reads drain; with the host FIFO
+ * full or the link forward, dj_p1284_console_putc() just waits.
+ * Channel addresses work as in platform/dj/p1284.c: echoes go back on
+ * the channel they came in on, the console first, and a switch costs a
+ * handshake for the address.  Run length counts are always understood
+ * going forward, and with -e the device sends its own.  There is no
+ * IRQ, as on a port without one.
+ */
+#define SIM_CMD 0x100			/* FIFO entry is a command byte */
+struct sim_port {
+  int rev;
+  int fch, rch;			/* device's channel, forward and reverse */
+  int rle;			/* negotiated: the host decodes runs */
+  int rlein, rleout;		/* forward count to apply, reverse run sent */
+  unsigned short fifo[SIM_FIFO];	/* forward, not yet taken by the device */
+  int nfifo;
+  char outq[NCHAN][SIM_OUTQ];	/* device tty output, free running indices */
+  unsigned int oi[NCHAN], oj[NCHAN];
+  unsigned short hostq[SIM_FIFO];	/* reverse, handshaken but not yet read */
+  int nhost;
+  unsigned long long rx_at;	/* when the device takes the next FIFO byte */
+  unsigned long long tx_at;	/* when the putc in progress completes */
+  unsigned long putcs, turns;
+};
+
+static unsigned long long max_ull (unsigned long long a, unsigned long long b) {
+  return a > b ? a : b;
+}
+
+/* The device's pick: console first, then whatever else is queued. */
+static int sim_pick (struct sim_port *sp) {
+  int ch;
+
+  for (ch = 0; ch < NCHAN; ch++)
+    if (sp->oj[ch] != sp->oi[ch]) return ch;
+  return -1;
+}
+
+/* The run at the head of a channel's output, as the device sees it */
+static int sim_run (struct sim_port *sp, int ch) {
+  unsigned int i = sp->oi[ch], end = sp->oj[ch];
+  char c = sp->outq[ch][i % SIM_OUTQ];
+
+  if (end - i > RLE_MAX) end = i + RLE_MAX;
+  while (++i != end && sp->outq[ch][i % SIM_OUTQ] == c) { };
+  return i - sp->oi[ch];
+}
+
+static void sim_advance (struct sim_port *sp, unsigned long long now) {
+  unsigned short e;
+  int ch, n, run;
+
+  while (sp->nfifo && now >= sp->rx_at) {
+    e = sp->fifo[0];
+    if (e & SIM_CMD) {
+      ch = e & ~(SIM_CMD | CH_ADDR);
+      if (!(e & CH_ADDR)) sp->rlein = ch + 1;
+      else if (ch < NCHAN) sp->fch = ch;
+    } else {
+      ch = sp->fch;
+      n = sp->rlein ? sp->rlein : 1;
+      if (SIM_OUTQ - (sp->oj[ch] - sp->oi[ch]) < n) break;
+      if (sim_pick(sp) < 0)	/* putc starts once there is something */
+	sp->tx_at = max_ull(sp->tx_at, sp->rx_at + SIM_PUTC_NS);
+      while (n--) sp->outq[ch][sp->oj[ch]++ % SIM_OUTQ] = e;
+      sp->rlein = 0;
+    }
+    memmove(sp->fifo, sp->fifo + 1, --sp->nfifo * sizeof(*sp->fifo));
+    sp->rx_at += SIM_RX_NS;
+  }
+  while (sp->rev && sp->nhost < SIM_FIFO && now >= sp->tx_at) {
+    if (sp->rleout) {		/* a count went out, its byte goes next */
+      ch = sp->rch;
+      sp->hostq[sp->nhost++] = (unsigned char)sp->outq[ch][sp->oi[ch] % SIM_OUTQ];
+      sp->oi[ch] += sp->rleout;
+      sp->rleout = 0;
+    } else if ((ch = sim_pick(sp)) < 0) {
+      break;
+    } else if (ch != sp->rch) {
+      sp->hostq[sp->nhost++] = SIM_CMD | CH_ADDR | ch;
+      sp->rch = ch;
+    } else if (sp->rle && (run = sim_run(sp, ch)) >= RLE_MIN) {
+      sp->hostq[sp->nhost++] = SIM_CMD | (run - 1);
+      sp->rleout = run;
+    } else {
+      sp->hostq[sp->nhost++] =
+	(unsigned char)sp->outq[ch][sp->oi[ch]++ % SIM_OUTQ];
+    }
+    sp->tx_at += SIM_PUTC_NS;
+    sp->putcs++;
+  }
+}
+
+static int sim_open (struct link *l, int report) {
+  struct sim_port *sp;
+
+  sp = calloc(1, sizeof(*sp));
+  if (!sp) return -1;
+  l->priv = sp;
+  return 0;
+}
+
+static void sim_close (struct link *l) {
+  struct sim_port *sp = l->priv;
+
+  fprintf(stderr, "sim: %lu putc handshakes, %lu turnarounds\n",
+	  sp->putcs, sp->turns);
+  free(sp);
+}
+
+static int sim_negotiate (struct link *l) {
+  struct sim_port *sp = l->priv;
+
+  sp->rle = l->rle;
+  return E1284_OK;
+}
+
+static int sim_write (struct link *l, const char *buf, int len, int cmd) {
+  struct sim_port *sp = l->priv;
+  unsigned long long now = mono_ns(), start = now;
+  int i;
+
+  sim_advance(sp, now);
+  if (sp->rev) {
+    sp->rev = 0;
+    sp->turns++;
+    start = now + SIM_TURN_NS;
+  }
+  if (len > SIM_FIFO - sp->nfifo) len = SIM_FIFO - sp->nfifo;
+  if (!len) return E1284_TIMEDOUT;
+  if (!sp->nfifo) sp->rx_at = max_ull(sp->rx_at, start) + SIM_RX_NS;
+  for (i = 0; i < len; i++)
+    sp->fifo[sp->nfifo++] = (unsigned char)buf[i] | (cmd ? SIM_CMD : 0);
+  return len;
+}
+
+static int sim_write_data (struct link *l, const char *buf, int len) {
+  return sim_write(l, buf, len, 0);
+}
+
+static int sim_write_addr (struct link *l, char c) {
+  return sim_write(l, &c, 1, 1);
+}
+
+static int sim_read_data (struct link *l, char *buf, int len) {
+  struct sim_port *sp = l->priv;
+  unsigned long long now = mono_ns();
+  int n, k, run;
+
+  sim_advance(sp, now);
+  if (!sp->nhost) return E1284_TIMEDOUT;
+  /* A full host FIFO stalled the handshake; it picks up from here */
+  if (sp->nhost == SIM_FIFO)
+    sp->tx_at = max_ull(sp->tx_at, now + SIM_PUTC_NS);
+  /*
+   * Like libieee1284: expand runs, but stop short of a channel address,
+   * or of a run that is incomplete or won't fit, and leave it there.
+   */
+  for (n = k = 0; n < len && k < sp->nhost; ) {
+    if (!(sp->hostq[k] & SIM_CMD)) {
+      buf[n++] = sp->hostq[k++];
+      continue;
+    }
+    if (sp->hostq[k] & CH_ADDR) break;
+    run = (sp->hostq[k] & ~SIM_CMD) + 1;
+    if (k + 1 == sp->nhost || n + run > len) break;
+    memset(buf + n, sp->hostq[k + 1], run);
+    n += run;
+    k += 2;
+  }
+  memmove(sp->hostq, sp->hostq + k, (sp->nhost - k) * sizeof(*sp->hostq));
+  sp->nhost -= k;
+  return n;
+}
+
+static int sim_read_addr (struct link *l, char *c) {
+  struct sim_port *sp = l->priv;
+
+  sim_advance(sp, mono_ns());
+  if (!sp->nhost || (sp->hostq[0] & (SIM_CMD | CH_ADDR)) != (SIM_CMD | CH_ADDR))
+    return E1284_TIMEDOUT;
+  *c = sp->hostq[0];
+  memmove(sp->hostq, sp->hostq + 1, --sp->nhost * sizeof(*sp->hostq));
+  return 1;
+}
+
+static int sim_fwd_to_rev (struct link *l) {
+  struct sim_port *sp = l->priv;
+  unsigned long long now = mono_ns();
+
+  sim_advance(sp, now);
+  if (sp->rev) return E1284_OK;
+  sp->rev = 1;
+  sp->turns++;
+  /* The byte that was waiting for us starts its handshake over */
+  sp->tx_at = max_ull(sp->tx_at, now + SIM_TURN_NS + SIM_PUTC_NS);
+  return E1284_OK;
+}
+
+/* The device asks for the bus whenever it has output waiting */
+static int sim_pending (struct link *l) {
+  struct sim_port *sp = l->priv;
+
+  sim_advance(sp, mono_ns());
+  return sp->nhost || sp->rleout || sim_pick(sp) >= 0;
+}
+
+static int sim_irq_fd (struct link *l) {
+  return -1;
+}
+
+static void sim_clear_irq (struct link *l) {
+}
+
+static const struct transport sim_transport = {
+  "sim", sim_open, sim_close, sim_negotiate,
+  sim_write_data, sim_read_data, sim_fwd_to_rev, sim_write_addr,
+  sim_read_addr, sim_pending, sim_irq_fd, sim_clear_irq
+};
+
+static const struct transport *transports[] = {
+  &hw_transport, &loop_transport, &pty_transport, &sim_transport, NULL
+};
+
+/* Load the next record, if there isn't one waiting already. */
+static int replay_next (struct trace *t) {
+  if (t->have) return 1;
+  if (fread(&t->rec, sizeof(t->rec), 1, t->f) != 1) return 0;
+  t->have = 1;
+  t->left = 0;
+  if ((t->rec.op == TR_READ || t->rec.op == TR_RADDR || t->rec.op == TR_INPUT
+       || t->rec.op == TR_BULKIN) && t->rec.ret > 0)
+    t->left = t->rec.ret;
+  t->span += t->rec.dt;
+  t->records++;
+  return 1;
+}
+
+static void replay_done (struct trace *t) {
+  t->have = 0;
+  t->stuck = 0;
+}
+
+/*
+ * Whether the record up next answers a call of this kind.  When the
+ * event loop makes some other call first (say it runs with different
+ * chunk sizes than the capture did) the port just looks busy to it, and
+ * a record nothing answers for REPLAY_STUCK calls is dropped.
+ */
+static int replay_match (struct trace *t, int op) {
+  if (!replay_next(t)) return 0;
+  if (t->rec.op == op) return 1;
+  t->diverged++;
+  if (++t->stuck >= REPLAY_STUCK) {
+    if (t->left) fseek(t->f, t->left, SEEK_CUR);
+    t->skipped++;
+    replay_done(t);
+  }
+  return 0;
+}
+
+static int replay_write_data (struct link *l, const char *buf, int len) {
+  struct trace *t = l->replay;
+  int ret;
+
+  if (!replay_match(t, TR_WRITE)) return E1284_TIMEDOUT;
+  ret = t->rec.ret;
+  if (ret > len) ret = len;
+  replay_done(t);
+  return ret;
+}
+
+static int replay_read_data (struct link *l, char *buf, int len) {
+  struct trace *t = l->replay;
+  int ret;
+
+  if (!replay_match(t, TR_READ)) return E1284_TIMEDOUT;
+  if (t->rec.ret <= 0) {
+    replay_done(t);
+    return t->rec.ret;
+  }
+  /* A smaller read than the capture made gets the rest next time */
+  ret = (t->left < len) ? t->left : len;
+  if (fread(buf, 1, ret, t->f) != ret) ret = E1284_SYS;
+  t->left -= ret;
+  if (ret < 0 || !t->left) replay_done(t);
+  return ret;
+}
+
+static int replay_fwd_to_rev (struct link *l) {
+  struct trace *t = l->replay;
+  int ret;
+
+  if (!replay_match(t, TR_TURN)) return E1284_OK;
+  ret = t->rec.ret;
+  replay_done(t);
+  return ret;
+}
+
+static int replay_write_addr (struct link *l, char c) {
+  struct trace *t = l->replay;
+  int ret;
+
+  if (!replay_match(t, TR_WADDR)) return E1284_TIMEDOUT;
+  ret = t->rec.ret;
+  replay_done(t);
+  return ret;
+}
+
+/* The scheduler's choices depend on the clock, so replay takes them too */
+static int replay_due (struct link *l) {
+  struct trace *t = l->replay;
+  int ret;
+
+  if (!replay_match(t, TR_DUE)) return 1;
+  ret = t->rec.ret;
+  replay_done(t);
+  return ret;
+}
+
+static int replay_read_addr (struct link *l, char *c) {
+  struct trace *t = l->replay;
+  int ret;
+
+  if (!replay_match(t, TR_RADDR)) return E1284_TIMEDOUT;
+  ret = t->rec.ret;
+  if (t->left && fread(c, 1, 1, t->f) != 1) ret = E1284_SYS;
+  if (t->left > 1) fseek(t->f, t->left - 1, SEEK_CUR);
+  t->left = 0;
+  replay_done(t);
+  return ret;
+}
+
+/* Only the data calls: replay_run() sets the link up by hand */
+static const struct transport replay_transport = {
+  "replay", NULL, NULL, NULL,
+  replay_write_data, replay_read_data, replay_fwd_to_rev, replay_write_addr,
+  replay_read_addr, NULL, NULL, NULL
+};
+
+/* Hand the console input the capture saw to the tx ring, in order. */
+static void replay_input (struct link *l) {
+  struct trace *t = l->replay;
+  struct ring *r;
+  int len;
+  char *p;
+
+  while (replay_next(t)
+	 && (t->rec.op == TR_INPUT || t->rec.op == TR_BULKIN)) {
+    r = (t->rec.op == TR_INPUT) ? &l->tx : &l->bulk.tx;
+    if (!r->buf) {		/* bulk, but replaying without -c */
+      fseek(t->f, t->left, SEEK_CUR);
+      t->left = 0;
+      replay_done(t);
+      continue;
+    }
+    p = ring_wspan(r, &len);
+    if (len > t->left) len = t->left;
+    if (!len) return;
+    if (fread(p, 1, len, t->f) != len) {
+      t->left = 0;
+      replay_done(t);
+      return;
+    }
+    r->j += len;
+    t->left -= len;
+    if (!t->left) replay_done(t);
+  }
+}
+
+/* Any write takes the bus forward first, if it wasn't already */
+static void link_fwd (struct link *l) {
+  if (l->rev) l->turns++;
+  l->rev = 0;
+}
+
+/* Every port call goes through here, so --trace sees them all. */
+static int link_write (struct link *l, const char *buf, int len) {
+  int ret;
+
+  link_fwd(l);
+  ret = l->ops->write_data(l, buf, len);
+  if (l->cap) trace_log(l->cap, TR_WRITE, len, ret, NULL);
+  if (ret > 0) l->moved += ret;
+  return ret;
+}
+
+static int link_read (struct link *l, char *buf, int len) {
+  int ret = l->ops->read_data(l, buf, len);
+
+  if (l->cap) trace_log(l->cap, TR_READ, len, ret, buf);
+  if (ret > 0) l->moved += ret;
+  return ret;
+}
+
+/* Reverse the bus, unless it already is. */
+static int link_turn (struct link *l) {
+  int ret;
+
+  if (l->rev) return E1284_OK;
+  ret = l->ops->fwd_to_rev(l);
+  if (l->cap) trace_log(l->cap, TR_TURN, 0, ret, NULL);
+  if (ret == E1284_OK) {
+    l->rev = 1;
+    l->turns++;
+  }
+  return ret;
+}
+
+static int link_write_addr (struct link *l, char c) {
+  int ret;
+
+  link_fwd(l);
+  ret = l->ops->write_addr(l, c);
+  if (l->cap) trace_log(l->cap, TR_WADDR, 1, ret, NULL);
+  return ret;
+}
+
+/*
+ * The direction scheduler.  Reversing the bus costs a handshake each
+ * way and stalls whatever the device was about to take from us, so only
+ * do it when a read is likely to get something: the bus is reversed
+ * already, the device is asking for it with PeriphRequest, or we have
+ * not looked for READ_OVERDUE_NS (devices that never ask still get
+ * read then).  A peer that can't say gets read whenever we like.
+ */
+static int link_rx_due (struct link *l, unsigned long long now) {
+  int due;
+
+  if (l->replay) return replay_due(l);
+  due = l->rev || now - l->rxlast >= READ_OVERDUE_NS || l->ops->pending(l);
+  if (l->cap) trace_log(l->cap, TR_DUE, 0, due, NULL);
+  return due;
+}
+
+/*
+ * And the other way: bulk data doesn't take the bus back from a device
+ * that is still sending, unless it has waited READ_OVERDUE_NS.  The
+ * console never waits.
+ */
+static int link_tx_due (struct link *l, int ch, unsigned long long now) {
+  int due;
+
+  if (l->replay) return replay_due(l);
+  due = !l->rev || ch == CH_CONSOLE || now - l->txlast >= READ_OVERDUE_NS
+    || l->ops->pending(l) <= 0;
+  if (l->cap) trace_log(l->cap, TR_DUE, 0, due, NULL);
+  return due;
+}
+
+static void turn_report (struct link *l) {
+  if (!l->turns) return;
+  fprintf(stderr, "%s: %lu turnarounds, %llu bytes, %.2f per KiB\n",
+	  l->name, l->turns, l->moved, l->turns * 1024.0 / (l->moved + 1));
+}
+
+static int link_read_addr (struct link *l, char *c) {
+  int ret = l->ops->read_addr(l, c);
+
+  if (l->cap) trace_log(l->cap, TR_RADDR, 1, ret, c);
+  return ret;
+}
+
+/* Commands are optional: without them we carry the console alone. */
+static void link_no_channels (struct link *l) {
+  fprintf(stderr, "%s: no ECP address commands, console only\n", l->name);
+  l->channels = 0;
+}
+
+static struct ring *link_rxring (struct link *l, int ch) {
+  if (ch == CH_BULK) return &l->bulk.rx;
+  if (ch == CH_KLOG) return &l->klog.rx;
+  return &l->rx;
+}
+
+/*
+ * Send a run as its count and one byte.  If only the count makes it,
+ * rlepend holds us to sending that byte next.  Returns bytes moved or < 0.
+ */
+static int ecp_tx_run (struct link *l, struct ring *r, const char *p, int run) {
+  int ret;
+
+  if (!l->rlepend) {
+    ret = link_write_addr(l, run - 1);
+    if (ret == E1284_NOTIMPL) {
+      fprintf(stderr, "%s: no ECP commands, runs go uncompressed\n", l->name);
+      l->rle = 0;
+      return 0;
+    }
+    if (ret != 1) return (ret < 0 && ret != E1284_TIMEDOUT) ? ret : 0;
+    l->rlepend = run;
+  }
+  ret = link_write(l, p, 1);
+  if (ret == 1) {
+    r->i += l->rlepend;
+    ret = l->rlepend;
+    l->rlepend = 0;
+  } else if (ret < 0 && ret != E1284_TIMEDOUT) {
+    fprintf(stderr,"%s: ECP write failed\n", l->name);
+  } else {
+    ret = 0;
+  }
+  return ret;
+}
+
+/*
+ * ECP forward: drain a tx ring into the device.  The console goes
+ * whenever it has anything; bulk only when it doesn't, and evloop()
+ * caps how much of that happens before the console gets another look.
+ * With -e, runs go as counts and literal data stops short of them.
+ * Returns bytes moved or < 0.
+ */
+static int ecp_tx (struct link *l) {
+  struct ring *r = &l->tx;
+  int count, asked, run = 0, ch = CH_CONSOLE;
+  char *p;
+
+  if (l->rlepend)		/* the device is waiting for the run's byte */
+    ch = l->channels ? l->txch : CH_CONSOLE;
+  else if (l->channels && !ring_used(r) && ring_used(&l->bulk.tx))
+    ch = CH_BULK;
+  if (ch == CH_BULK) r = &l->bulk.tx;
+  p = ring_rspan(r, &count);
+  if (!count || !link_tx_due(l, ch, mono_ns())) return 0;
+  l->txlast = mono_ns();
+  if (l->rle) {
+    run = l->rlepend ? l->rlepend : rle_run(p, count);
+    if (run < RLE_MIN) {
+      run = 0;
+      count = rle_lit(p, count);
+    }
+  }
+  if (count > l->txchunk.size) count = l->txchunk.size;
+  if (l->channels && ch != l->txch) {
+    asked = link_write_addr(l, CH_ADDR | ch);
+    if (asked == E1284_NOTIMPL) {
+      link_no_channels(l);
+    } else if (asked != 1) {
+      return (asked < 0 && asked != E1284_TIMEDOUT) ? asked : 0;
+    } else {
+      l->txch = ch;
+    }
+  }
+  if (run) return ecp_tx_run(l, r, p, run);
+  asked = count;
+  count = link_write(l, p, count);
+  if (count > 0) {
+    r->i += count;
+  } else if (count < 0 && count != E1284_TIMEDOUT) {
+    fprintf(stderr,"%s: ECP write failed\n", l->name);
+    return count;
+  }
+  if (count < 0) count = 0;
+  chunk_tune(&l->txchunk, asked, count);
+  return count;
+}
+
+/*
+ * ECP reverse: fill the rx ring of whatever channel the device is on.
+ * A read that comes back short may have stopped at a channel address,
+ * so with -c we pick that up before the next one.  Returns bytes moved
+ * or < 0.
+ */
+static int ecp_rx (struct link *l) {
+  struct ring *r = l->channels ? link_rxring(l, l->rxch) : &l->rx;
+  int count, asked, ret, span;
+  char *p, c;
+  unsigned char ch;
+
+  p = ring_wspan(r, &span);
+  count = span;
+  if (count > l->rxchunk.size) count = l->rxchunk.size;
+  /* Room for a whole run, or the read stops short in front of it */
+  if (l->rle && count < RLE_MAX) count = span < RLE_MAX ? span : RLE_MAX;
+  if (!count) return 0;
+  asked = count;
+  link_turn(l);
+  l->rxlast = mono_ns();
+  count = link_read(l, p, count);
+  if (l->channels && count < asked) {
+    ret = link_read_addr(l, &c);
+    ch = c;
+    if (ret == 1 && (ch & CH_ADDR))
+      l->rxch = ((ch & ~CH_ADDR) < NCHAN) ? (ch & ~CH_ADDR) : CH_CONSOLE;
+    else if (ret == E1284_NOTIMPL)
+      link_no_channels(l);
+  }
+  if (count > 0) {
+    r->j += count;
+  } else if (count < 0 && count != E1284_TIMEDOUT) {
+    fprintf(stderr,"%s: ECP read failed\n", l->name);
+    return count;
+  }
+  if (count < 0) count = 0;
+  chunk_tune(&l->rxchunk, asked, count);
+  return count;
+}
+
+/* Drain the rx ring to the console output. */
+static int tty_tx (struct link *l) {
+  struct iovec iov[2];
+  int count, n;
+
+  n = ring_iov(&l->rx, iov, 0);
+  if (!n) return 0;
+  if (bench.phase != BENCH_OFF) {
+    /* Measuring, not talking: the console output is just discarded */
+    l->rx.i = l->rx.j;
+    return 0;
+  }
+  count = writev(l->out, iov, n);
+  if (count > 0) {
+    l->rx.i += count;
+  } else if (count < 0 && errno != EAGAIN) {
+    perror("tty write failed: ");
+    return count;
+  }
+  return 0;
+}
+
+/*
+ * Fill the tx ring from the console input.  At EOF it stops being polled,
+ * or poll() would keep saying it's readable; what's queued still goes.
+ */
+static int tty_rx (struct link *l) {
+  struct iovec iov[2];
+  int count, n;
+
+  n = ring_iov(&l->tx, iov, 1);
+  if (!n) return 0;
+  count = readv(l->in, iov, n);
+  if (count > 0) {
+    if (l->cap) trace_input(l->cap, TR_INPUT, &l->tx, l->tx.j, count);
+    l->tx.j += count;
+  } else if (!count) {
+    l->in = -1;
+  } else if (errno != EAGAIN) {
+    perror("tty read failed: ");
+    return count;
+  }
+  return 0;
+}
+
+/*
+ * The other channels' files.  Input at EOF is closed and forgotten;
+ * unlike the console, that doesn't end the session.
+ */
+static int stream_tx (struct stream *st) {
+  struct iovec iov[2];
+  int count, n;
+
+  if (st->out < 0) {
+    st->rx.i = st->rx.j;
+    return 0;
+  }
+  n = ring_iov(&st->rx, iov, 0);
+  if (!n) return 0;
+  count = writev(st->out, iov, n);
+  if (count > 0) {
+    st->rx.i += count;
+  } else if (count < 0 && errno != EAGAIN) {
+    perror("channel write failed: ");
+    return count;
+  }
+  return 0;
+}
+
+static int bulk_rx (struct link *l) {
+  struct stream *st = &l->bulk;
+  struct iovec iov[2];
+  int count, n;
+
+  n = ring_iov(&st->tx, iov, 1);
+  if (!n) return 0;
+  count = readv(st->in, iov, n);
+  if (count > 0) {
+    if (l->cap) trace_input(l->cap, TR_BULKIN, &st->tx, st->tx.j, count);
+    st->tx.j += count;
+  } else if (!count) {
+    close(st->in);
+    st->in = -1;
+  } else if (errno != EAGAIN) {
+    perror("channel read failed: ");
+    return count;
+  }
+  return 0;
+}
+
+/* Queue bytes of our own for the device.  Returns how many fit. */
+static int tx_queue (struct link *l, const char *s, int len) {
+  int i;
+
+  for (i = 0; i < len && ring_room(&l->tx); i++)
+    l->tx.buf[l->tx.j++ & (l->tx.size - 1)] = s[i];
+  return i;
+}
+
+/* Queue a latency probe when the device has been quiet for a while. */
+static void lat_probe (struct link *l, unsigned long long now) {
+  if (!lat.todo || lat.waiting) return;
+  if (now - lat.quiet < LAT_QUIET_NS) return;
+  if (!tx_queue(l, "\n", 1)) return;
+  lat.todo--;
+  lat.waiting = 1;
+  lat.sent = now;
+}
+
+/* Account for received bytes against the probe in flight. */
+static void lat_echo (unsigned long long now) {
+  lat.quiet = now;
+  if (!lat.waiting) return;
+  lat.waiting = 0;
+  lat.done++;
+  lat.samples[lat.nsamples++] = now - lat.sent;
+}
+
+static int cmp_ull (const void *a, const void *b) {
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+
+  return (x > y) - (x < y);
+}
+
+static double lat_pct (int pct) {
+  return lat.samples[(lat.nsamples - 1) * pct / 100] / 1000.0;
+}
+
+static void lat_report (void) {
+  unsigned long long sum;
+  int i;
+
+  if (!lat.done) {
+    fprintf(stderr, "latency: no echoes received\n");
+    return;
+  }
+  qsort(lat.samples, lat.nsamples, sizeof(*lat.samples), cmp_ull);
+  for (sum = 0, i = 0; i < lat.nsamples; i++) sum += lat.samples[i];
+  fprintf(stderr, "latency: %i round trips, min %.1f avg %.1f "
+	  "p50 %.1f p90 %.1f p99 %.1f max %.1f us\n",
+	  lat.done, lat_pct(0), sum / 1000.0 / lat.nsamples,
+	  lat_pct(50), lat_pct(90), lat_pct(99), lat_pct(100));
+}
+
+static void chunk_report (struct chunk *c) {
+  fprintf(stderr, "%s: %llu bytes in %lu calls (%lu short), "
+	  "chunk %i now, %i..%i seen%s\n", c->name, c->bytes, c->calls,
+	  c->shorts, c->size, c->lo, c->hi, c->adaptive ? " (adaptive)" : "");
+}
+
+static void bench_report (struct link *l) {
+  fprintf(stderr, "bench: %u KiB each way\n", bench.kib);
+  fprintf(stderr, "bench: tx %.0f bytes/s\n", bench.txrate);
+  fprintf(stderr, "bench: rx %.0f bytes/s\n", bench.rxrate);
+  chunk_report(&l->txchunk);
+  chunk_report(&l->rxchunk);
+}
+
+/* Bytes arrived from the device while benchmarking. */
+static void bench_rx (int count, unsigned long long now) {
+  if (bench.phase != BENCH_RX) return;
+  if (!bench.t0) bench.t0 = now;
+  bench.left = (bench.left > count) ? bench.left - count : 0;
+  if (!bench.left) {
+    bench.t1 = now;
+    bench.rxrate = bench.kib * 1024.0 * 1e9 / (bench.t1 - bench.t0 + 1);
+    if (!lat.todo) lat.todo = LAT_BENCH_PROBES;
+    bench.phase = BENCH_LAT;
+  }
+}
+
+/*
+ * Advance --latency/--bench.  Returns nonzero once there is nothing
+ * left to measure and everything we queued has gone out.
+ */
+static int bench_step (struct link *l, unsigned long long now) {
+  static const char line[64] =
+    "0123456789abcdefghijklmnopqrstuvwxyz"
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ-\n";
+  char cmd[80];
+  int n;
+
+  switch (bench.phase) {
+  case BENCH_SETUP:
+    tx_queue(l, "stty -echo; cat >/dev/null\n", 27);
+    bench.phase = BENCH_TXWAIT;
+    lat.quiet = now;
+    break;
+  case BENCH_TXWAIT:
+    if (ring_used(&l->tx) || now - lat.quiet < BENCH_QUIET_NS) break;
+    bench.left = bench.kib * 1024ULL;
+    bench.t0 = now;
+    bench.phase = BENCH_TX;
+    /* fall through */
+  case BENCH_TX:
+    while (bench.left) {
+      n = sizeof(line) - (bench.kib * 1024ULL - bench.left) % sizeof(line);
+      if (n > bench.left) n = bench.left;
+      n = tx_queue(l, line + sizeof(line) - n, n);
+      if (!n) break;
+      bench.left -= n;
+    }
+    if (bench.left || ring_used(&l->tx)) break;
+    bench.t1 = now;
+    bench.txrate = bench.kib * 1024.0 * 1e9 / (bench.t1 - bench.t0 + 1);
+    tx_queue(l, "\n\004", 2);
+    bench.phase = BENCH_RXWAIT;
+    lat.quiet = now;
+    break;
+  case BENCH_RXWAIT:
+    if (ring_used(&l->tx) || now - lat.quiet < BENCH_QUIET_NS) break;
+    n = snprintf(cmd, sizeof(cmd),
+		 "dd if=/dev/zero bs=1024 count=%u 2>/dev/null\n", bench.kib);
+    tx_queue(l, cmd, n);
+    bench.left = bench.kib * 1024ULL;
+    bench.t0 = 0;
+    bench.phase = BENCH_RX;
+    lat.quiet = now;
+    break;
+  case BENCH_RX:
+    if (now - lat.quiet > BENCH_STALL_NS) {
+      fprintf(stderr, "bench: rx stalled with %llu bytes to go\n",
+	      bench.left);
+      bench_rx(bench.left, now);
+    }
+    break;
+  case BENCH_LAT:
+    if (lat.waiting && now - lat.sent > LAT_TIMEOUT_NS) {
+      fprintf(stderr, "latency: probe lost\n");
+      lat.waiting = 0;
+    }
+    if (lat.todo || lat.waiting) {
+      lat_probe(l, now);
+      break;
+    }
+    if (bench.kib) tx_queue(l, "stty echo\n", 10);
+    bench.phase = BENCH_DONE;
+    break;
+  case BENCH_DONE:
+    if (ring_used(&l->tx)) break;
+    if (bench.kib) bench_report(l);
+    lat_report();
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * --ring-bench: no port needed.  Runs the console side of each ring
+ * against /dev/null and /dev/zero and the device side as chunk sized
+ * memcpys, once per layout: the old one-span-per-call buffer, the same
+ * buffer with readv/writev, and the mirrored mapping.
+ */
+enum { RING_SPLIT, RING_IOV, RING_MIRROR };
+static const char *ring_layouts[] = { "split", "iovec", "mirror" };
+
+static int ring_bench_io (struct ring *r, int fd, int layout, int fill) {
+  struct iovec iov[2];
+  int n, len;
+
+  if (layout == RING_SPLIT) {
+    iov[0].iov_base = fill ? ring_wspan(r, &len) : ring_rspan(r, &len);
+    iov[0].iov_len = len;
+    n = len ? 1 : 0;
+  } else {
+    n = ring_iov(r, iov, fill);
+  }
+  if (!n) return 0;
+  n = fill ? readv(fd, iov, n) : writev(fd, iov, n);
+  if (n < 0) {
+    perror("ring bench: ");
+    return -1;
+  }
+  if (fill)
+    r->j += n;
+  else
+    r->i += n;
+  return 1;
+}
+
+/* One batch through the device end, as ECP calls of at most chunk bytes. */
+static unsigned long ring_bench_dev (struct ring *r, int chunk, int fill) {
+  static char scratch[CHUNK_MAX];
+  unsigned long calls = 0;
+  int left = RING_BENCH_BATCH, len;
+  char *p;
+
+  while (left) {
+    p = fill ? ring_wspan(r, &len) : ring_rspan(r, &len);
+    if (len > chunk) len = chunk;
+    if (len > left) len = left;
+    if (!len) break;
+    if (fill) {
+      memcpy(p, scratch, len);
+      r->j += len;
+    } else {
+      memcpy(scratch, p, len);
+      r->i += len;
+    }
+    left -= len;
+    calls++;
+  }
+  return calls;
+}
+
+static int ring_bench_pass (int layout, unsigned int mib, int rx) {
+  struct ring r;
+  unsigned long long total = mib * 1048576ULL, moved = 0, t0, t1;
+  unsigned long sys = 0, dev = 0;
+  unsigned int mark;
+  int fd, ret = 0;
+
+  if (ring_init(&r, rx ? RX_RING_SIZE : TX_RING_SIZE, layout == RING_MIRROR))
+    return -1;
+  if (layout == RING_MIRROR && !r.mirrored) {
+    fprintf(stderr, "ring: no mirrored mapping on this system\n");
+    ring_free(&r);
+    return 0;
+  }
+  fd = open(rx ? "/dev/null" : "/dev/zero", rx ? O_WRONLY : O_RDONLY);
+  if (fd < 0) {
+    perror("ring bench: ");
+    ring_free(&r);
+    return -1;
+  }
+  t0 = mono_ns();
+  while (moved < total && ret >= 0) {
+    if (rx) {
+      /* Device fills, console drains everything it can */
+      mark = r.j;
+      dev += ring_bench_dev(&r, rxchunk.size, 1);
+      moved += r.j - mark;
+      while (ring_used(&r) && (ret = ring_bench_io(&r, fd, layout, 0)) > 0)
+	sys++;
+    } else {
+      /* Console fills all the room there is, device drains */
+      while (ring_room(&r) && (ret = ring_bench_io(&r, fd, layout, 1)) > 0)
+	sys++;
+      mark = r.i;
+      dev += ring_bench_dev(&r, txchunk.size, 0);
+      moved += r.i - mark;
+    }
+  }
+  t1 = mono_ns();
+  if (ret >= 0)
+    fprintf(stderr, "ring %s %-6s %8.1f syscalls/MiB %8.1f ECP calls/MiB "
+	    "%8.1f MiB/s\n", rx ? "rx" : "tx", ring_layouts[layout],
+	    sys * 1048576.0 / moved, dev * 1048576.0 / moved,
+	    moved / 1048576.0 * 1e9 / (t1 - t0 + 1));
+  close(fd);
+  ring_free(&r);
+  return ret < 0 ? ret : 0;
+}
+
+static int ring_bench (unsigned int mib) {
+  int layout, rx;
+
+  for (rx = 0; rx < 2; rx++)
+    for (layout = RING_SPLIT; layout <= RING_MIRROR; layout++)
+      if (ring_bench_pass(layout, mib, rx)) return -1;
+  return 0;
+}
+
+/*
+ * --rle-bench: what run length encoding does to the number of bytes
+ * the link has to carry for an image, and so to its throughput, since
+ * the link moves bytes at a fixed rate either way.  Each image goes
+ * through rle_run() and rle_lit() just as ecp_tx() would send it.
+ */
+static void rle_bench_one (const char *name, const char *buf, int len) {
+  unsigned long long t0, t1;
+  unsigned long wire = 0, runs = 0;
+  int off, n;
+
+  t0 = mono_ns();
+  for (off = 0; off < len; off += n) {
+    n = rle_run(buf + off, len - off);
+    if (n >= RLE_MIN) {
+      wire += 2;
+      runs++;
+    } else {
+      n = rle_lit(buf + off, len - off);
+      wire += n;
+    }
+  }
+  t1 = mono_ns();
+  printf("%-24s %8i bytes %8lu on the wire %6lu runs  %5.2fx  "
+	 "encode %6.0f MB/s\n", name, len, wire, runs,
+	 (double)len / (wire ? wire : 1), len * 1e3 / (t1 - t0 + 1));
+}
+
+/*
+ * Made up stand-ins for what we upload when no files are given: a
+ * ROMFS image (16 byte aligned headers and files, some text and some
+ * code, padded out to 1 KiB), a buffer mostly zero padding and erased
+ * flash, and noise for the worst case.
+ */
+static void rle_bench_synth (char *buf, int which) {
+  static const char text[] = "#!/bin/sh\nmount -t proc proc /proc\n";
+  int off = 0, n, i;
+
+  srand(1);
+  memset(buf, 0, RLE_BENCH_SIZE);
+  switch (which) {
+  case 0:
+    memcpy(buf, "-rom1fs-", 8);
+    off = 32;
+    while (off < RLE_BENCH_SIZE * 7 / 8) {
+      off += 32;			/* file header and name */
+      n = 100 + rand() % 8000;
+      for (i = 0; i < n && off + i < RLE_BENCH_SIZE; i++)
+	buf[off + i] = (rand() & 1) ? text[i % (sizeof(text) - 1)] : rand();
+      off = (off + n + 15) & ~15;
+    }
+    break;
+  case 1:
+    for (; off < RLE_BENCH_SIZE / 6; off++) buf[off] = rand();
+    memset(buf + RLE_BENCH_SIZE / 2, 0xff, RLE_BENCH_SIZE / 4);
+    break;
+  default:
+    for (; off < RLE_BENCH_SIZE; off++) buf[off] = rand();
+  }
+}
+
+static int rle_bench (char **files, int nfiles) {
+  static const char *synth[] = { "romfs (made up)", "padded (made up)",
+				 "noise (made up)" };
+  struct stat st;
+  char *buf;
+  FILE *f;
+  int i, len;
+
+  if (!nfiles) {
+    buf = malloc(RLE_BENCH_SIZE);
+    if (!buf) return -1;
+    for (i = 0; i < 3; i++) {
+      rle_bench_synth(buf, i);
+      rle_bench_one(synth[i], buf, RLE_BENCH_SIZE);
+    }
+    free(buf);
+    return 0;
+  }
+  for (i = 0; i < nfiles; i++) {
+    f = fopen(files[i], "r");
+    if (!f || fstat(fileno(f), &st)) {
+      perror(files[i]);
+      if (f) fclose(f);
+      return -1;
+    }
+    len = st.st_size;
+    buf = malloc(len ? len : 1);
+    if (!buf || fread(buf, 1, len, f) != len) {
+      perror(files[i]);
+      free(buf);
+      fclose(f);
+      return -1;
+    }
+    fclose(f);
+    rle_bench_one(files[i], buf, len);
+    free(buf);
+  }
+  return 0;
+}
+
+/*
+ * Event loop.  We sleep in poll() on stdin, stdout and the port's
+ * interrupt fd.  Only a loopback's fd says by itself that the peer has
+ * something: a 1284 peripheral asks for the bus with PeriphRequest,
+ * which raises no IRQ, and nAck only strobes once the bus is reversed.
+ * So a port that can ask still gets a timed poll, short right after
+ * traffic and backing off to POLL_MAX_MS once the link goes idle, and
+ * its IRQ just gets reverse data in sooner.  Either way a read only
+ * happens once link_rx_due() says so; until then we poll every
+ * POLL_MIN_MS to see whether it has.
+ */
+int evloop (struct link *l) {
+  struct pollfd pfd[6];
+  int nfds, timeout, count, idle_ms, rxpend, burst, txfull, queued, rxwait;
+  int irqwake;
+  unsigned long long now;
+
+  irqwake = l->irqfd >= 0 && l->ops->pending
+    && l->ops->pending(l) == E1284_NOTIMPL;
+  idle_ms = POLL_MIN_MS;
+  rxpend = 1;
+  lat.quiet = mono_ns();
+
+  for (;;) {
+    if (bench.phase != BENCH_OFF && bench_step(l, mono_ns()))
+      return 1;
+    if (l->replay) {
+      replay_input(l);
+      if (!replay_next(l->replay) && !ring_used(&l->rx)) return 1;
+    }
+
+    /* Move everything the device will take or give without waiting */
+    burst = CH_BULK_BURST;
+    txfull = 0;
+    do {
+      count = ecp_tx(l);
+      txfull = !count;
+      if (count < 0) return count;
+      if (count > 0) rxpend = 1;	/* Expect an echo */
+      /* Enough bulk for now, see if there are keystrokes to go first */
+      if (l->txch == CH_BULK && (burst -= count) <= 0) break;
+    } while (count > 0);
+
+    rxwait = 0;
+    if (rxpend && !link_rx_due(l, mono_ns())) {
+      rxpend = 0;
+      rxwait = 1;
+    }
+    if (rxpend) {
+      count = ecp_rx(l);
+      if (count < 0) return count;
+      if (count > 0) {
+	now = mono_ns();
+	lat_echo(now);
+	bench_rx(count, now);
+	idle_ms = POLL_MIN_MS;
+      }
+      /* A full chunk means more is probably waiting */
+      rxpend = (count > 0 && count >= l->rxchunk.size);
+    }
+
+    if (tty_tx(l) < 0) return -1;
+    if (l->channels && (stream_tx(&l->bulk) < 0 || stream_tx(&l->klog) < 0))
+      return -1;
+
+    nfds = 0;
+    if (l->in >= 0 && ring_room(&l->tx) && bench.phase == BENCH_OFF) {
+      pfd[nfds].fd = l->in;
+      pfd[nfds++].events = POLLIN;
+    }
+    if (ring_used(&l->rx)) {
+      pfd[nfds].fd = l->out;
+      pfd[nfds++].events = POLLOUT;
+    }
+    if (l->irqfd >= 0) {
+      pfd[nfds].fd = l->irqfd;
+      pfd[nfds++].events = POLLIN;
+    }
+    if (l->channels && l->bulk.in >= 0 && ring_room(&l->bulk.tx)) {
+      pfd[nfds].fd = l->bulk.in;
+      pfd[nfds++].events = POLLIN;
+    }
+    if (l->channels && l->bulk.out >= 0 && ring_used(&l->bulk.rx)) {
+      pfd[nfds].fd = l->bulk.out;
+      pfd[nfds++].events = POLLOUT;
+    }
+    if (l->channels && l->klog.out >= 0 && ring_used(&l->klog.rx)) {
+      pfd[nfds].fd = l->klog.out;
+      pfd[nfds++].events = POLLOUT;
+    }
+
+    /*
+     * Don't spin on a device whose FIFO is full: every write attempt
+     * turns the bus forward again and holds up what it has for us.
+     * Nor wait for an IRQ, though; the FIFO drains without one.
+     */
+    queued = ring_used(&l->tx) || ring_used(&l->bulk.tx);
+    if (rxpend || l->replay || (queued && !txfull)) {
+      timeout = 0;
+    } else if (queued || rxwait) {
+      timeout = POLL_MIN_MS;
+    } else if (irqwake) {
+      timeout = (bench.phase != BENCH_OFF) ? 1 : -1;
+    } else {
+      timeout = idle_ms;
+      if (idle_ms < POLL_MAX_MS) idle_ms++;
+    }
+
+    if (poll(pfd, nfds, timeout) < 0) {
+      if (errno == EINTR) continue;
+      perror("poll failed: ");
+      return -1;
+    }
+
+    while (nfds--) {
+      if (!pfd[nfds].revents) continue;
+      if (pfd[nfds].fd == l->irqfd) {
+	l->ops->clear_irq(l);
+	rxpend = 1;
+      } else if (pfd[nfds].fd == l->in) {
+	if (pfd[nfds].revents & (POLLERR | POLLHUP | POLLNVAL)
+	    && !(pfd[nfds].revents & POLLIN))
+	  return 1;
+	if (tty_rx(l) < 0) return -1;
+	idle_ms = POLL_MIN_MS;
+      } else if (pfd[nfds].fd == l->bulk.in) {
+	if (bulk_rx(l) < 0) return -1;
+      }
+    }
+    /* Nothing would have told us, so look at the bus after every poll */
+    if (!irqwake || rxwait) rxpend = 1;
+  }
+}
+
+/* Rings and chunk settings, before there is any port behind a link. */
+static int link_init (struct link *l, const char *name) {
+  l->name = name;
+  l->ops = &hw_transport;
+  l->irqfd = -1;
+  l->txchunk = txchunk;
+  l->rxchunk = rxchunk;
+  l->rle = rle;
+  l->bulk.in = l->bulk.out = l->klog.in = l->klog.out = -1;
+  if (ring_init(&l->tx, TX_RING_SIZE, 1)) return -1;
+  if (ring_init(&l->rx, RX_RING_SIZE, 1)) {
+    ring_free(&l->tx);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Turn on channels, with bulk coming from and going to the given files
+ * (either may be NULL) and the kernel log going to klog.
+ */
+static int link_channels (struct link *l, const char *bulksend,
+			  const char *bulkrecv, int klog) {
+  l->channels = 1;
+  l->txch = -1;			/* first write says where it's going */
+  l->rxch = CH_CONSOLE;
+  if (ring_init(&l->bulk.tx, TX_RING_SIZE, 1)
+      || ring_init(&l->bulk.rx, RX_RING_SIZE, 1)
+      || ring_init(&l->klog.rx, RX_RING_SIZE, 1))
+    return -1;
+  if (bulksend && (l->bulk.in = open(bulksend, O_RDONLY | O_NONBLOCK)) < 0) {
+    perror(bulksend);
+    return -1;
+  }
+  if (bulkrecv && (l->bulk.out = open(bulkrecv, O_WRONLY | O_CREAT | O_TRUNC,
+				      0644)) < 0) {
+    perror(bulkrecv);
+    return -1;
+  }
+  l->klog.out = klog;
+  return 0;
+}
+
+static void link_fini (struct link *l) {
+  ring_free(&l->tx);
+  ring_free(&l->rx);
+  ring_free(&l->bulk.tx);
+  ring_free(&l->bulk.rx);
+  ring_free(&l->klog.rx);
+  if (l->bulk.in >= 0) close(l->bulk.in);
+  if (l->bulk.out >= 0) close(l->bulk.out);
+  l->bulk.in = l->bulk.out = -1;
+  if (l->cap) trace_close(l->cap);
+  l->cap = NULL;
+  if (l->ptyname[0]) {
+    close(l->ptyslave);
+    close(l->pty);
+    l->ptyname[0] = 0;
+  }
+}
+
+/*
+ * Open a link over a transport (port is only for libieee1284) and bring
+ * it up in ECP mode.  With report set we chatter about it on stdout like
+ * we always have.
+ */
+static int link_open (struct link *l, const struct transport *ops,
+		      struct parport *port, int report) {
+  int ret;
+
+  l->port = port;
+  if (link_init(l, port ? port->name : ops->name)) return -1;
+  l->ops = ops;
+  if ((ret = ops->open(l, report))) goto bail0;
+  l->irqfd = ops->irq_fd(l);
+  if (l->irqfd < 0) {
+    l->irqfd = -1;
+    fprintf(stderr, "%s: no IRQ, polling every %i-%i ms\n",
+	    l->name, POLL_MIN_MS, POLL_MAX_MS);
+  }
+  if ((ret = ops->negotiate(l))) {
+    fprintf(stderr,"%s: couldn't enter ECP mode (%i)\n", l->name, ret);
+    goto bail1;
+  }
+  return 0;
   bail1:
-  ieee1284_close(port);
+  ops->close(l);
+  bail0:
+  link_fini(l);
+  return ret ? ret : -1;
+}
+
+static void link_close (struct link *l) {
+  turn_report(l);
+  l->ops->close(l);
+  link_fini(l);
+}
+
+/* Start recording a link, to path, or to path-<port> with several links. */
+static int link_trace (struct link *l, const char *path, int suffix) {
+  char buf[256];
+  const char *base;
+
+  if (suffix) {
+    base = strrchr(l->name, '/');
+    snprintf(buf, sizeof(buf), "%s-%s", path, base ? base + 1 : l->name);
+    path = buf;
+  }
+  l->cap = trace_open(path, 1);
+  return l->cap ? 0 : -1;
+}
+
+/*
+ * Give a link a PTY for its console.  We keep the slave open ourselves
+ * so the master never reads EIO/HUP while no terminal program is
+ * attached, and put it in raw mode since the device does the echoing.
+ * If linkdir is set, linkdir/ecp-<port> is pointed at the slave.
+ */
+static int link_pty (struct link *l, const char *linkdir) {
+  struct termios tio;
+  char path[256];
+  const char *base;
+  int fd, slave;
+
+  fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) || unlockpt(fd) || !ptsname(fd)) {
+    perror("pty: ");
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  snprintf(l->ptyname, sizeof(l->ptyname), "%s", ptsname(fd));
+  slave = open(l->ptyname, O_RDWR | O_NOCTTY);
+  if (slave < 0) {
+    perror(l->ptyname);
+    l->ptyname[0] = 0;
+    close(fd);
+    return -1;
+  }
+  if (!tcgetattr(slave, &tio)) {
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  l->in = l->out = l->pty = fd;
+  l->ptyslave = slave;
+
+  if (linkdir) {
+    base = strrchr(l->name, '/');
+    base = base ? base + 1 : l->name;
+    snprintf(path, sizeof(path), "%s/ecp-%s", linkdir, base);
+    unlink(path);
+    if (symlink(l->ptyname, path)) perror(path);
+  }
+  fprintf(stderr, "%s: console on %s\n", l->name, l->ptyname);
+  return 0;
+}
+
+static void *link_thread (void *arg) {
+  struct link *l = arg;
+
+  while (!(l->ret = evloop(l))) { };
+  fprintf(stderr, "%s: link down (%i)\n", l->name, l->ret);
+  link_close(l);
+  return NULL;
+}
+
+/* Serve every port we can claim, each from its own thread. */
+static int daemon_run (struct parport_list *pl, const char *linkdir,
+		       const char *tracepath) {
+  struct link *links;
+  int i, n;
+
+  links = calloc(pl->portc, sizeof(*links));
+  if (!links) {
+    perror("calloc");
+    return -1;
+  }
+  for (n = 0, i = 0; i < pl->portc; i++) {
+    if (link_open(&links[n], &hw_transport, pl->portv[i], 0)) continue;
+    if (link_pty(&links[n], linkdir)
+	|| (tracepath && link_trace(&links[n], tracepath, 1))) {
+      link_close(&links[n]);
+      continue;
+    }
+    if (pthread_create(&links[n].thread, NULL, link_thread, &links[n])) {
+      perror("pthread_create");
+      link_close(&links[n]);
+      continue;
+    }
+    n++;
+  }
+  if (!n) {
+    fprintf(stderr, "no usable ports\n");
+    free(links);
+    return -1;
+  }
+  for (i = 0; i < n; i++)
+    pthread_join(links[i].thread, NULL);
+  free(links);
+  return 0;
+}
+
+/*
+ * Run a capture back through the event loop against the simulated port,
+ * as fast as the loop will go.  The console output is what the device
+ * sent, so it goes to stdout like it would have live.
+ */
+static int replay_run (const char *path, int channels, const char *bulkrecv) {
+  static struct link link;
+  unsigned long long t0, t1;
+  struct trace *t;
+  int ret;
+
+  if (link_init(&link, "replay")) return -1;
+  t = link.replay = trace_open(path, 0);
+  if (!t) {
+    link_fini(&link);
+    return -1;
+  }
+  link.ops = &replay_transport;
+  link.in = -1;
+  link.out = fileno(stdout);
+  /* Bulk input comes from the trace, not a file */
+  if (channels && link_channels(&link, NULL, bulkrecv, fileno(stderr))) {
+    trace_close(t);
+    link_fini(&link);
+    return -1;
+  }
+
+  t0 = mono_ns();
+  while (!(ret = evloop(&link))) { };
+  t1 = mono_ns();
+
+  fprintf(stderr, "replay: %lu records, %lu calls diverged, %lu records "
+	  "dropped\n", t->records, t->diverged, t->skipped);
+  fprintf(stderr, "replay: %.3f s of capture in %.3f s (%.1fx)\n",
+	  t->span / 1e9, (t1 - t0) / 1e9, (double)t->span / (t1 - t0 + 1));
+  chunk_report(&link.txchunk);
+  chunk_report(&link.rxchunk);
+  turn_report(&link);
+  trace_close(t);
+  link_fini(&link);
+  return ret < 0 ? ret : 0;
+}
+
+static void usage (const char *name) {
+  fprintf(stderr,
+	  "usage: %s [-a] [-t N] [-r N] [-l N] [-b KIB] [-R MIB] [-d [DIR]]\n"
+	  "          [-w FILE | -p FILE] [-T NAME] [-c [-s FILE] [-o FILE]] [-e]\n"
+	  "       %s -E [FILE...]\n"
+	  "  -a, --adaptive    tune chunk sizes to what the link sustains\n"
+	  "  -t, --tx-chunk N  bytes per ECP write call (default %i)\n"
+	  "  -r, --rx-chunk N  bytes per ECP read call (default %i)\n"
+	  "  -l, --latency N   time N newline echo round trips and exit\n"
+	  "  -b, --bench KIB   push and pull KIB through the device shell,\n"
+	  "                    report bytes/s and latency, and exit\n"
+	  "  -R, --ring-bench MIB  compare ring layouts moving MIB each way\n"
+	  "                    without touching a port, and exit\n"
+	  "  -d, --daemon[=DIR] serve every port on its own PTY, symlinked\n"
+	  "                    as DIR/ecp-<port> if DIR is given\n"
+	  "  -w, --trace FILE  record every ECP call to FILE (FILE-<port>\n"
+	  "                    with -d)\n"
+	  "  -p, --replay FILE run a recorded trace against a simulated port,\n"
+	  "                    as fast as possible, and exit\n"
+	  "  -T, --transport NAME  ieee1284 (default); loop, an in-process\n"
+	  "                    echo; pty, a PTY for another program to play\n"
+	  "                    the device on; or sim, a simulated DJ console\n"
+	  "  -c, --channels    carry console, bulk and kernel log on separate\n"
+	  "                    ECP channels; the log goes to stderr.  Replaying\n"
+	  "                    a capture made with -c needs it too\n"
+	  "  -s, --bulk-send FILE  with -c, push FILE over the bulk channel\n"
+	  "  -o, --bulk-recv FILE  with -c, save the bulk channel in FILE\n"
+	  "  -e, --rle         negotiate ECP with run length encoding and\n"
+	  "                    compress runs we send; replay needs it too\n"
+	  "  -E, --rle-bench   show what RLE saves on each FILE, or on some\n"
+	  "                    made up images, and exit\n",
+	  name, name, TX_CHUNK_SIZE, RX_CHUNK_SIZE);
+}
+
+static int chunk_arg (const char *arg) {
+  int n = atoi(arg);
+
+  if (n < 1) n = 1;
+  if (n > CHUNK_MAX) n = CHUNK_MAX;
+  return n;
+}
+
+/* A whole number from 1 to max, or -1 */
+static long count_arg (const char *arg, long max) {
+  char *end;
+  long n;
+
+  errno = 0;
+  n = strtol(arg, &end, 10);
+  if (errno || end == arg || *end || n < 1 || n > max) return -1;
+  return n;
+}
+
+int main (int argc, char **argv)
+{
+  static struct link link;
+  struct parport_list pl;
+  int ret, daemon = 0, ringmib = 0, channels = 0, rlebench = 0;
+  const char *linkdir = NULL, *tracepath = NULL, *replaypath = NULL;
+  const char *bulksend = NULL, *bulkrecv = NULL;
+  const struct transport *ops = &hw_transport;
+  static const struct option opts[] = {
+    { "adaptive", no_argument, NULL, 'a' },
+    { "tx-chunk", required_argument, NULL, 't' },
+    { "rx-chunk", required_argument, NULL, 'r' },
+    { "latency", required_argument, NULL, 'l' },
+    { "bench", required_argument, NULL, 'b' },
+    { "ring-bench", required_argument, NULL, 'R' },
+    { "daemon", optional_argument, NULL, 'd' },
+    { "trace", required_argument, NULL, 'w' },
+    { "replay", required_argument, NULL, 'p' },
+    { "transport", required_argument, NULL, 'T' },
+    { "channels", no_argument, NULL, 'c' },
+    { "bulk-send", required_argument, NULL, 's' },
+    { "bulk-recv", required_argument, NULL, 'o' },
+    { "rle", no_argument, NULL, 'e' },
+    { "rle-bench", no_argument, NULL, 'E' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while ((ret = getopt_long(argc, argv, "at:r:l:b:R:d::w:p:T:cs:o:eEh", opts, NULL)) != -1) {
+    switch (ret) {
+    case 'a':
+      txchunk.adaptive = rxchunk.adaptive = 1;
+      break;
+    case 't':
+      txchunk.size = chunk_arg(optarg);
+      break;
+    case 'r':
+      rxchunk.size = chunk_arg(optarg);
+      break;
+    case 'l':
+      if ((lat.todo = count_arg(optarg, LAT_MAX)) < 0) {
+	fprintf(stderr, "-l takes a probe count from 1 to %i\n", LAT_MAX);
+	usage(argv[0]);
+	return 1;
+      }
+      if (bench.phase == BENCH_OFF) bench.phase = BENCH_LAT;
+      break;
+    case 'b':
+      if ((ret = count_arg(optarg, BENCH_KIB_MAX)) < 0) {
+	fprintf(stderr, "-b takes a size from 1 to %i KiB\n", BENCH_KIB_MAX);
+	usage(argv[0]);
+	return 1;
+      }
+      bench.kib = ret;
+      bench.phase = BENCH_SETUP;
+      break;
+    case 'R':
+      ringmib = atoi(optarg);
+      if (ringmib < 1) ringmib = 1;
+      break;
+    case 'd':
+      daemon = 1;
+      linkdir = optarg;
+      break;
+    case 'w':
+      tracepath = optarg;
+      break;
+    case 'p':
+      replaypath = optarg;
+      break;
+    case 'T':
+      for (ret = 0; transports[ret]; ret++)
+	if (!strcmp(optarg, transports[ret]->name)) break;
+      if (!transports[ret]) {
+	fprintf(stderr, "unknown transport %s\n", optarg);
+	return 1;
+      }
+      ops = transports[ret];
+      break;
+    case 'c':
+      channels = 1;
+      break;
+    case 's':
+      bulksend = optarg;
+      break;
+    case 'o':
+      bulkrecv = optarg;
+      break;
+    case 'e':
+      rle = 1;
+      break;
+    case 'E':
+      rlebench = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return ret != 'h';
+    }
+  }
+  if (ringmib)
+    return ring_bench(ringmib) ? 1 : 0;
+  if (rlebench)
+    return rle_bench(argv + optind, argc - optind) ? 1 : 0;
+  if ((daemon || replaypath) && bench.phase != BENCH_OFF) {
+    fprintf(stderr, "--latency and --bench need a single live port\n");
+    return 1;
+  }
+  if ((bulksend || bulkrecv) && !channels) {
+    fprintf(stderr, "--bulk-send and --bulk-recv need -c\n");
+    return 1;
+  }
+  if (replaypath && bulksend) {
+    fprintf(stderr, "--replay takes bulk input from the trace\n");
+    return 1;
+  }
+  if (replaypath)
+    return replay_run(replaypath, channels, bulkrecv) ? 1 : 0;
+  if (daemon && channels) {
+    fprintf(stderr, "-c needs a single port, not -d\n");
+    return 1;
+  }
+  if (daemon && ops != &hw_transport) {
+    fprintf(stderr, "-d serves libieee1284 ports only\n");
+    return 1;
+  }
+  if (bench.phase != BENCH_OFF) {
+    lat.samples = calloc(lat.todo + LAT_BENCH_PROBES, sizeof(*lat.samples));
+    if (!lat.samples) {
+      perror("calloc");
+      return -1;
+    }
+  }
+
+  pl.portc = 0;
+  if (ops == &hw_transport) {
+    ieee1284_find_ports (&pl, 0);
+    if (pl.portc < 1) {
+      fprintf (stderr, "no parallel ports found\n");
+      return -1;
+    }
+  }
+
+  if (daemon) {
+    ret = daemon_run(&pl, linkdir, tracepath);
+    ieee1284_free_ports(&pl);
+    return ret;
+  }
+
+  ret = fcntl(fileno(stdin),F_GETFL);
+  fcntl(fileno(stdin),F_SETFL,ret | O_NONBLOCK);
+  ret = fcntl(fileno(stdout),F_GETFL);
+  fcntl(fileno(stdout),F_SETFL,ret | O_NONBLOCK);
+  link.in = fileno(stdin);
+  link.out = fileno(stdout);
+
+  if ((ret = link_open(&link, ops, pl.portc ? pl.portv[0] : NULL, 1)))
+    goto bail;
+  if (tracepath && (ret = link_trace(&link, tracepath, 0))) {
+    link_close(&link);
+    goto bail;
+  }
+  if (channels
+      && (ret = link_channels(&link, bulksend, bulkrecv, fileno(stderr)))) {
+    link_close(&link);
+    goto bail;
+  }
+  while (!(ret = evloop(&link))) { };
+  if (ret > 0) ret = 0;
+  link_close(&link);
   bail:
+  if (pl.portc) ieee1284_free_ports(&pl);
   return ret;
 }
 
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/*
+ * How long an exec takes, and what a running process costs, for the
+ * sort of thing vendors/HP/DJ895C/rc.vendor does: one busybox applet
+ * after another.  Run on the printer, as a flat binary:
+ *
+ *   m68k-uclinux-gcc -mcpu=5206 -O2 -Wl,-elf2flt -o execbench execbench.c
+ *
+ * Each command of the script is run -n times over (vfork and exec, no
+ * shell), and the microseconds from vfork to reaping it shown per
+ * command.  Then -k copies of "sleep" are started at once, and MemFree
+ * before and after says what each one costs.  If the kernel has
+ * platform/dj/flatcache.c, all of that is done with the cache off and
+ * then on, and /proc/dj_flatcache shown at the end.
+ */
+
+#define FLATCACHE_MAX "/sys/module/dj_flatcache/parameters/max"
+#define FLATCACHE_PROC "/proc/dj_flatcache"
+#define MAX_CMDS 64
+#define MAX_ARGS 16
+#define MAX_SLEEPERS 64
+
+/* rc.vendor, less what would change anything */
+static const char *const default_script[] = {
+  "hostname",
+  "mount",
+  "mkdir -p /var/tmp",
+  "mkdir -p /var/log",
+  "mkdir -p /var/run",
+  "mkdir -p /var/lock",
+  "mkdir -p /var/empty",
+  "echo YADAYADAYADA",
+  "cat /etc/motd",
+};
+
+struct cmd {
+  char *line;
+  char *argv[MAX_ARGS + 1];
+  unsigned long long min, max, total;
+  int runs, failed;
+};
+
+static struct cmd cmds[MAX_CMDS];
+static int ncmds;
+
+static unsigned long long mono_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/***************************************************************************/
+
+static int add_cmd (const char *line) {
+  struct cmd *c;
+  char *p;
+  int n = 0;
+
+  while (*line == ' ' || *line == '\t') line++;
+  if (!*line || *line == '#' || *line == '\n') return 0;
+  if (ncmds == MAX_CMDS) {
+    fprintf(stderr, "more than %i commands\n", MAX_CMDS);
+    return -1;
+  }
+  c = &cmds[ncmds++];
+  c->line = strdup(line);
+  p = strdup(line);
+  if (!c->line || !p) return -1;
+  c->line[strcspn(c->line, "\n")] = 0;
+  for (p = strtok(p, " \t\n"); p && n < MAX_ARGS; p = strtok(NULL, " \t\n"))
+    c->argv[n++] = p;
+  c->argv[n] = NULL;
+  return 0;
+}
+
+static int load_script (const char *name) {
+  char line[256];
+  FILE *f;
+  int i;
+
+  if (!name) {
+    for (i = 0; i < sizeof(default_script) / sizeof(*default_script); i++)
+      if (add_cmd(default_script[i])) return -1;
+    return 0;
+  }
+  f = fopen(name, "r");
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", name, strerror(errno));
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f))
+    if (add_cmd(line)) {
+      fclose(f);
+      return -1;
+    }
+  fclose(f);
+  return 0;
+}
+
+/* vfork and exec argv, output to /dev/null; the child's pid, or -1 */
+static pid_t spawn (char *const argv[]) {
+  pid_t pid;
+
+  pid = vfork();
+  if (pid) return pid;
+  dup2(open("/dev/null", O_WRONLY), 1);
+  execvp(argv[0], argv);
+  _exit(127);
+}
+
+/***************************************************************************/
+
+static void run_script (int passes) {
+  unsigned long long t, pass_min = ~0ULL, pass_total = 0;
+  struct cmd *c;
+  int i, status;
+
+  for (c = cmds; c < cmds + ncmds; c++) {
+    c->min = ~0ULL;
+    c->max = c->total = 0;
+    c->runs = c->failed = 0;
+  }
+  for (i = 0; i < passes; i++) {
+    unsigned long long pass = 0;
+
+    for (c = cmds; c < cmds + ncmds; c++) {
+      pid_t pid;
+
+      t = mono_ns();
+      pid = spawn(c->argv);
+      if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+	  !WIFEXITED(status) || WEXITSTATUS(status)) {
+	c->failed++;
+	continue;
+      }
+      t = mono_ns() - t;
+      c->runs++;
+      c->total += t;
+      if (t < c->min) c->min = t;
+      if (t > c->max) c->max = t;
+      pass += t;
+    }
+    pass_total += pass;
+    if (pass < pass_min) pass_min = pass;
+  }
+
+  printf("%8s %8s %8s  %s\n", "min us", "avg us", "max us", "command");
+  for (c = cmds; c < cmds + ncmds; c++) {
+    if (!c->runs) {
+      printf("%8s %8s %8s  %s (failed)\n", "-", "-", "-", c->line);
+      continue;
+    }
+    printf("%8llu %8llu %8llu  %s%s\n", c->min / 1000,
+	   c->total / c->runs / 1000, c->max / 1000, c->line,
+	   c->failed ? " (failed sometimes)" : "");
+  }
+  printf("whole script: %llu us best, %llu us average\n", pass_min / 1000,
+	 pass_total / passes / 1000);
+}
+
+/***************************************************************************/
+
+static long memfree_kb (void) {
+  char line[128];
+  long kb = -1;
+  FILE *f;
+
+  f = fopen("/proc/meminfo", "r");
+  if (!f) return -1;
+  while (fgets(line, sizeof(line), f))
+    if (sscanf(line, "MemFree: %ld kB", &kb) == 1) break;
+  fclose(f);
+  return kb;
+}
+
+/* What k more copies of "sleep" cost between them, per copy */
+static void run_sleepers (int k) {
+  static char *argv[] = { "sleep", "60", NULL };
+  pid_t pids[MAX_SLEEPERS];
+  long before, after;
+  int i, n = 0;
+
+  before = memfree_kb();
+  for (i = 0; i < k; i++) {
+    pids[n] = spawn(argv);
+    if (pids[n] > 0) n++;
+  }
+  usleep(500000);
+  after = memfree_kb();
+  if (before < 0 || after < 0 || !n)
+    printf("no MemFree to go by\n");
+  else
+    printf("%i sleepers: %ld kB in all, %ld kB each\n", n, before - after,
+	   (before - after) / n);
+  for (i = 0; i < n; i++) {
+    kill(pids[i], SIGTERM);
+    waitpid(pids[i], NULL, 0);
+  }
+}
+
+/***************************************************************************/
+
+/* The cache's limit as it was, or -1 if there's no cache */
+static long cache_get (void) {
+  long kb = -1;
+  FILE *f;
+
+  f = fopen(FLATCACHE_MAX, "r");
+  if (!f) return -1;
+  if (fscanf(f, "%ld", &kb) != 1) kb = -1;
+  fclose(f);
+  return kb;
+}
+
+static void cache_set (long kb) {
+  FILE *f;
+
+  f = fopen(FLATCACHE_MAX, "w");
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", FLATCACHE_MAX, strerror(errno));
+    return;
+  }
+  fprintf(f, "%ld\n", kb);
+  fclose(f);
+}
+
+static void show_cache (void) {
+  char line[128];
+  FILE *f;
+
+  f = fopen(FLATCACHE_PROC, "r");
+  if (!f) return;
+  printf("\n%s:\n", FLATCACHE_PROC);
+  while (fgets(line, sizeof(line), f)) fputs(line, stdout);
+  fclose(f);
+}
+
+static void usage (const char *name) {
+  fprintf(stderr,
+	  "usage: %s [-n passes] [-k sleepers] [-s script]\n"
+	  "  -n, --passes N    times through the script (default 20)\n"
+	  "  -k, --sleepers K  sleeps running at once for MemFree (default 8)\n"
+	  "  -s, --script F    commands from F, one a line, not rc.vendor's\n",
+	  name);
+}
+
+int main (int argc, char **argv)
+{
+  const char *script = NULL;
+  int ret, passes = 20, sleepers = 8;
+  long max_kb;
+  static const struct option opts[] = {
+    { "passes", required_argument, NULL, 'n' },
+    { "sleepers", required_argument, NULL, 'k' },
+    { "script", required_argument, NULL, 's' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while ((ret = getopt_long(argc, argv, "n:k:s:h", opts, NULL)) != -1) {
+    switch (ret) {
+    case 'n':
+      passes = atoi(optarg);
+      break;
+    case 'k':
+      sleepers = atoi(optarg);
+      break;
+    case 's':
+      script = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return ret == 'h' ? 0 : 1;
+    }
+  }
+  if (optind != argc || passes < 1 || sleepers < 1 ||
+      sleepers > MAX_SLEEPERS) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (load_script(script)) return 1;
+
+  max_kb = cache_get();
+  if (max_kb > 0) {
+    printf("flatcache off:\n");
+    cache_set(0);
+    run_script(passes);
+    run_sleepers(sleepers);
+    cache_set(max_kb);
+    printf("\nflatcache on, %ld kB:\n", max_kb);
+  }
+  run_script(passes);
+  run_sleepers(sleepers);
+  show_cache();
+  return 0;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * /proc/dj_irqsoff from the printer, with its addresses looked up in
+ * the kernel's System.map.  The kernel runs where it was linked, so the
+ * map's addresses are the ones in the table.  On the host:
+ *
+ *   cc -O2 -o irqsoffsym irqsoffsym.c
+ *   ./irqsoffsym linux-2.6.x/System.map < dj_irqsoff
+ *
+ * Each 0x address in the input is followed by the function it's in and
+ * how far into it, and the rest is copied out as it came.
+ */
+
+struct sym {
+  unsigned long addr;
+  char *name;
+};
+
+static struct sym *syms;
+static size_t nsyms;
+
+static int sym_cmp (const void *a, const void *b) {
+  const struct sym *x = a, *y = b;
+
+  return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/* Text symbols only, sorted by address */
+static int load_map (const char *name) {
+  char line[256], type, sym[200];
+  size_t room = 0;
+  unsigned long addr;
+  FILE *f;
+
+  f = fopen(name, "r");
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", name, strerror(errno));
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "%lx %c %199s", &addr, &type, sym) != 3) continue;
+    if (type != 't' && type != 'T') continue;
+    if (nsyms == room) {
+      room = room ? room * 2 : 4096;
+      syms = realloc(syms, room * sizeof(*syms));
+      if (!syms) {
+	fprintf(stderr, "out of memory\n");
+	fclose(f);
+	return -1;
+      }
+    }
+    syms[nsyms].addr = addr;
+    syms[nsyms].name = strdup(sym);
+    nsyms++;
+  }
+  fclose(f);
+  if (!nsyms) {
+    fprintf(stderr, "%s: no text symbols\n", name);
+    return -1;
+  }
+  qsort(syms, nsyms, sizeof(*syms), sym_cmp);
+  return 0;
+}
+
+/* The last symbol at or below addr, or NULL */
+static const struct sym *lookup (unsigned long addr) {
+  size_t lo = 0, hi = nsyms;
+
+  if (addr < syms[0].addr) return NULL;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+
+    if (syms[mid].addr <= addr) lo = mid;
+    else hi = mid;
+  }
+  return &syms[lo];
+}
+
+static void symbolize (const char *line) {
+  const struct sym *s;
+  unsigned long addr;
+  char *end;
+
+  while (*line) {
+    if (line[0] != '0' || line[1] != 'x') {
+      putchar(*line++);
+      continue;
+    }
+    addr = strtoul(line, &end, 16);
+    fwrite(line, 1, end - line, stdout);
+    line = end;
+    s = lookup(addr);
+    if (s) printf(" %s+0x%lx", s->name, addr - s->addr);
+  }
+}
+
+int main (int argc, char **argv)
+{
+  char line[512];
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s System.map < dj_irqsoff\n", argv[0]);
+    return 1;
+  }
+  if (load_map(argv[1])) return 1;
+  while (fgets(line, sizeof(line), stdin)) symbolize(line);
+  return 0;
+}
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+/*
+ * MB/s of the movem memcpy and memset in platform/dj/string.S, at 16
+ * and 32 bytes a burst, next to the C ones in arch/m68knommu/lib, over
+ * a spread of sizes and alignments.  Everything is checked against a
+ * byte loop first, guard bytes and all.  As a flat binary, for the
+ * printer or for qemu, which loads those too:
+ *
+ *   m68k-uclinux-gcc -mcpu=5206 -O2 -Wl,-elf2flt -DDJ_MEM_BENCH -o membench \
+ *     membench.c ../linux-2.6.x/arch/m68knommu/platform/dj/string.S
+ *   qemu-m68k -cpu cfv4e ./membench
+ *
+ * or with m68k-linux-gnu-gcc -static and "qemu-m68k -cpu any".  qemu's
+ * numbers say which is less work, not how fast the printer does it.
+ * Built for anything else, the lib versions stand in for the movem
+ * ones so the harness itself can be tried out.
+ */
+
+/* Largest size timed, and the slack either side for alignment and guards */
+#define MAX_SIZE 65536
+#define SLACK 64
+#define GUARD 0xa5
+/* Sizes checked exhaustively, at every alignment */
+#define CHECK_SIZES 300
+
+typedef void *(*copy_fn) (void *dst, const void *src, size_t n);
+typedef void *(*set_fn) (void *s, int c, size_t n);
+
+/*
+ * arch/m68knommu/lib/memcpy.c and memset.c, CONFIG_COLDFIRE side, as
+ * they were before string.S; int for their long, to run anywhere.
+ */
+static void *lib_memcpy (void *to, const void *from, size_t n) {
+  void *xto = to;
+  size_t temp;
+
+  if (!n) return xto;
+  if ((long) to & 1) {
+    char *cto = to;
+    const char *cfrom = from;
+    *cto++ = *cfrom++;
+    to = cto;
+    from = cfrom;
+    n--;
+  }
+  if (n > 2 && (long) to & 2) {
+    short *sto = to;
+    const short *sfrom = from;
+    *sto++ = *sfrom++;
+    to = sto;
+    from = sfrom;
+    n -= 2;
+  }
+  temp = n >> 2;
+  if (temp) {
+    int *lto = to;
+    const int *lfrom = from;
+    for (; temp; temp--) *lto++ = *lfrom++;
+    to = lto;
+    from = lfrom;
+  }
+  if (n & 2) {
+    short *sto = to;
+    const short *sfrom = from;
+    *sto++ = *sfrom++;
+    to = sto;
+    from = sfrom;
+  }
+  if (n & 1) {
+    char *cto = to;
+    const char *cfrom = from;
+    *cto = *cfrom;
+  }
+  return xto;
+}
+
+static void *lib_memset (void *s, int c, size_t count) {
+  void *xs = s;
+  size_t temp;
+
+  if (!count) return xs;
+  c &= 0xff;
+  c |= c << 8;
+  c |= c << 16;
+  if ((long) s & 1) {
+    char *cs = s;
+    *cs++ = c;
+    s = cs;
+    count--;
+  }
+  if (count > 2 && (long) s & 2) {
+    short *ss = s;
+    *ss++ = c;
+    s = ss;
+    count -= 2;
+  }
+  temp = count >> 2;
+  if (temp) {
+    int *ls = s;
+    for (; temp; temp--) *ls++ = c;
+    s = ls;
+  }
+  if (count & 2) {
+    short *ss = s;
+    *ss++ = c;
+    s = ss;
+  }
+  if (count & 1) {
+    char *cs = s;
+    *cs = c;
+  }
+  return xs;
+}
+
+#ifdef __m68k__
+extern void *dj_memcpy16 (void *dst, const void *src, size_t n);
+extern void *dj_memcpy32 (void *dst, const void *src, size_t n);
+extern void *dj_memset16 (void *s, int c, size_t n);
+extern void *dj_memset32 (void *s, int c, size_t n);
+#else
+#define dj_memcpy16 lib_memcpy
+#define dj_memcpy32 lib_memcpy
+#define dj_memset16 lib_memset
+#define dj_memset32 lib_memset
+#endif
+
+static const struct {
+  const char *name;
+  copy_fn copy;
+  set_fn set;
+} impls[] = {
+  { "lib", lib_memcpy, lib_memset },
+  { "movem16", dj_memcpy16, dj_memset16 },
+  { "movem32", dj_memcpy32, dj_memset32 },
+};
+#define NIMPLS (sizeof(impls) / sizeof(*impls))
+
+static const size_t sizes[] = { 8, 16, 32, 64, 128, 256, 1024, 4096, MAX_SIZE };
+#define NSIZES (sizeof(sizes) / sizeof(*sizes))
+
+/* Destination and source offsets from a long word */
+static const struct { int dst, src; } aligns[] = {
+  { 0, 0 }, { 1, 1 }, { 2, 2 }, { 0, 1 }, { 0, 2 }, { 3, 0 },
+};
+#define NALIGNS (sizeof(aligns) / sizeof(*aligns))
+
+static unsigned char srcbuf[MAX_SIZE + 2 * SLACK] __attribute__ ((aligned (16)));
+static unsigned char dstbuf[MAX_SIZE + 2 * SLACK] __attribute__ ((aligned (16)));
+static unsigned char refbuf[MAX_SIZE + 2 * SLACK] __attribute__ ((aligned (16)));
+
+static unsigned long long mono_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*****************************************************************************/
+
+static void fill (unsigned char *p, size_t n, unsigned seed) {
+  while (n--) *p++ = (seed = seed * 1103515245 + 12345) >> 16;
+}
+
+static int check_one (int impl, int set, size_t n, int doff, int soff) {
+  unsigned char *d = dstbuf + SLACK + doff, *r = refbuf + SLACK + doff;
+  const unsigned char *s = srcbuf + SLACK + soff;
+  void *ret;
+  size_t i;
+
+  memset(dstbuf, GUARD, sizeof(dstbuf));
+  memset(refbuf, GUARD, sizeof(refbuf));
+  if (set) {
+    ret = impls[impl].set(d, s[0] | 0x100, n);
+    for (i = 0; i < n; i++) r[i] = s[0];
+  } else {
+    ret = impls[impl].copy(d, s, n);
+    for (i = 0; i < n; i++) r[i] = s[i];
+  }
+  if (ret != d || memcmp(dstbuf, refbuf, sizeof(dstbuf))) {
+    fprintf(stderr, "%s %s wrong: %lu bytes, dst +%i, src +%i%s\n",
+	    impls[impl].name, set ? "memset" : "memcpy", (unsigned long) n,
+	    doff, soff, ret != d ? ", returned the wrong pointer" : "");
+    return -1;
+  }
+  return 0;
+}
+
+static int check (void) {
+  int impl, set, doff, soff, bad = 0;
+  size_t n;
+
+  fill(srcbuf, sizeof(srcbuf), 1);
+  for (impl = 0; impl < NIMPLS; impl++)
+    for (set = 0; set < 2; set++)
+      for (n = 0; n < CHECK_SIZES; n++)
+	for (doff = 0; doff < 4; doff++)
+	  for (soff = 0; soff < (set ? 1 : 4); soff++)
+	    if (check_one(impl, set, n, doff, soff) && ++bad > 20) return -1;
+  for (impl = 0; impl < NIMPLS; impl++)
+    for (set = 0; set < 2; set++)
+      if (check_one(impl, set, MAX_SIZE, 1, set ? 0 : 3)) bad++;
+  return bad ? -1 : 0;
+}
+
+/*****************************************************************************/
+
+/* MB/s for moving about total bytes n at a time */
+static double bench_one (int impl, int set, size_t n, int doff, int soff,
+			 unsigned long total) {
+  unsigned char *d = dstbuf + SLACK + doff;
+  const unsigned char *s = srcbuf + SLACK + soff;
+  unsigned long reps = total / n, i;
+  unsigned long long t;
+
+  if (!reps) reps = 1;
+  t = mono_ns();
+  if (set)
+    for (i = 0; i < reps; i++) impls[impl].set(d, i, n);
+  else
+    for (i = 0; i < reps; i++) impls[impl].copy(d, s, n);
+  t = mono_ns() - t;
+  if (!t) t = 1;
+  return (double) reps * n * 1000.0 / t;
+}
+
+static void bench (int set, unsigned long total) {
+  int a, impl, k;
+
+  printf("\n%s, MB/s\n%6s %4s %4s", set ? "memset" : "memcpy", "size", "dst",
+	 set ? "" : "src");
+  for (impl = 0; impl < NIMPLS; impl++) printf(" %9s", impls[impl].name);
+  printf("\n");
+  for (k = 0; k < NSIZES; k++)
+    for (a = 0; a < NALIGNS; a++) {
+      /* memset has no source, so only one of each destination */
+      if (set && aligns[a].src && aligns[a].src != aligns[a].dst) continue;
+      printf("%6lu %4i", (unsigned long) sizes[k], aligns[a].dst);
+      if (set) printf(" %4s", "");
+      else printf(" %4i", aligns[a].src);
+      for (impl = 0; impl < NIMPLS; impl++)
+	printf(" %9.2f", bench_one(impl, set, sizes[k], aligns[a].dst,
+				   aligns[a].src, total));
+      printf("\n");
+      fflush(stdout);
+    }
+}
+
+static void usage (const char *name) {
+  fprintf(stderr,
+	  "usage: %s [-m MB] [-c]\n"
+	  "  -m, --megs MB   bytes moved per measurement (default 4)\n"
+	  "  -c, --check     only check the results, don't time them\n",
+	  name);
+}
+
+int main (int argc, char **argv)
+{
+  unsigned long total = 4UL << 20;
+  int ret, only_check = 0;
+  static const struct option opts[] = {
+    { "megs", required_argument, NULL, 'm' },
+    { "check", no_argument, NULL, 'c' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while ((ret = getopt_long(argc, argv, "m:ch", opts, NULL)) != -1) {
+    switch (ret) {
+    case 'm':
+      total = strtoul(optarg, NULL, 0) << 20;
+      if (!total) {
+	fprintf(stderr, "%s: at least a megabyte\n", argv[0]);
+	return 1;
+      }
+      break;
+    case 'c':
+      only_check = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return ret == 'h' ? 0 : 1;
+    }
+  }
+  if (optind != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (check()) return 1;
+  printf("all %u checked against a byte loop\n", (unsigned) NIMPLS);
+  if (only_check) return 0;
+  bench(0, total);
+  bench(1, total);
+  return 0;
+}
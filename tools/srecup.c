@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/parport.h>
+#include <linux/ppdev.h>
+
+/*
+ * Stream a binary image to the boot ROM as S-records, made up as we go.
+ * This is how runkernel sends the kernel, where it used to srec_cat it
+ * into a file and cat that into /dev/lp0.
+ */
+
+#define DEFAULT_DEVICE "/dev/parport0"
+#define DEFAULT_LOAD 0x02010000	/* CONFIG_KERNELBASE */
+/* An S3 count byte covers the address and checksum too, so 250 at most */
+#define SREC_MAX_DATA 250
+/* Records made up per read of the image, and the longest one as text */
+#define RECS_PER_READ 256
+#define SREC_MAX_TEXT (4 + 2 * 255 + 1)
+#define PROGRESS_NS 500000000ULL
+
+struct upload;
+
+/*
+ * Where the records go.  "ppdev" is the real thing; "file" writes them
+ * out for a look, or for some other tool to send; "null" throws them
+ * away, which leaves nothing but the generator to time.
+ */
+struct sink {
+  const char *name;
+  int (*open) (struct upload *u, const char *arg);
+  ssize_t (*write) (struct upload *u, const char *buf, size_t len);
+  void (*close) (struct upload *u);
+};
+
+struct upload {
+  const struct sink *ops;
+  int fd;
+  int quiet;
+  unsigned long long size;	/* of the image, 0 if we can't tell */
+  unsigned long long in, out;	/* image bytes done, and record bytes sent */
+  unsigned long long t0, tlast;
+};
+
+static char hexpair[256][2];
+
+static unsigned long long mono_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/***************************************************************************/
+
+/*
+ * Compatibility mode is all the ROM speaks.  We claim the port through
+ * ppdev and write it in big blocks; parport_pc runs the nStrobe/Busy
+ * handshake from the chipset's FIFO where it has one, so there is no
+ * per-byte round trip through the kernel, and no lp driver polling for
+ * status in between.
+ */
+static int pp_open (struct upload *u, const char *dev) {
+  int mode = IEEE1284_MODE_COMPAT;
+
+  u->fd = open(dev, O_WRONLY);
+  if (u->fd < 0) {
+    perror(dev);
+    return -1;
+  }
+  if (ioctl(u->fd, PPCLAIM)) {
+    fprintf(stderr, "%s: couldn't claim: %s\n", dev, strerror(errno));
+    close(u->fd);
+    return -1;
+  }
+  if (ioctl(u->fd, PPNEGOT, &mode) || ioctl(u->fd, PPSETMODE, &mode)) {
+    fprintf(stderr, "%s: no compatibility mode: %s\n", dev, strerror(errno));
+    ioctl(u->fd, PPRELEASE);
+    close(u->fd);
+    return -1;
+  }
+  return 0;
+}
+
+static ssize_t fd_write (struct upload *u, const char *buf, size_t len) {
+  return write(u->fd, buf, len);
+}
+
+static void pp_close (struct upload *u) {
+  ioctl(u->fd, PPRELEASE);
+  close(u->fd);
+}
+
+static const struct sink pp_sink = {
+  "ppdev", pp_open, fd_write, pp_close
+};
+
+static int file_open (struct upload *u, const char *path) {
+  u->fd = strcmp(path, "-") ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+    : dup(fileno(stdout));
+  if (u->fd < 0) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+static void file_close (struct upload *u) {
+  close(u->fd);
+}
+
+static const struct sink file_sink = {
+  "file", file_open, fd_write, file_close
+};
+
+static int null_open (struct upload *u, const char *arg) {
+  return 0;
+}
+
+static ssize_t null_write (struct upload *u, const char *buf, size_t len) {
+  return len;
+}
+
+static void null_close (struct upload *u) {
+}
+
+static const struct sink null_sink = {
+  "null", null_open, null_write, null_close
+};
+
+static const struct sink *sinks[] = { &pp_sink, &file_sink, &null_sink };
+
+/***************************************************************************/
+
+static void progress (struct upload *u, int last) {
+  unsigned long long now = mono_ns();
+  double secs = (now - u->t0) / 1e9;
+
+  if (u->quiet || (!last && now - u->tlast < PROGRESS_NS)) return;
+  u->tlast = now;
+  if (u->size)
+    fprintf(stderr, "\r%llu/%llu KiB (%3.0f%%)", u->in / 1024, u->size / 1024,
+	    u->in * 100.0 / u->size);
+  else
+    fprintf(stderr, "\r%llu KiB", u->in / 1024);
+  fprintf(stderr, "  %.0f B/s of records, %.0f B/s of image%s",
+	  u->out / (secs ? secs : 1), u->in / (secs ? secs : 1),
+	  last ? "\n" : "   ");
+}
+
+static int sink_write (struct upload *u, const char *buf, size_t len) {
+  ssize_t ret;
+
+  while (len) {
+    ret = u->ops->write(u, buf, len);
+    if (ret < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      perror(u->ops->name);
+      return -1;
+    }
+    buf += ret;
+    len -= ret;
+    u->out += ret;
+  }
+  return 0;
+}
+
+/***************************************************************************/
+
+static char *hex (char *p, unsigned int b) {
+  p[0] = hexpair[b][0];
+  p[1] = hexpair[b][1];
+  return p + 2;
+}
+
+/* One record, of alen address bytes and n data bytes, at p */
+static char *srec_put (char *p, int type, unsigned long addr, int alen,
+		       const unsigned char *data, int n) {
+  unsigned int sum, b;
+  int i;
+
+  *p++ = 'S';
+  *p++ = '0' + type;
+  sum = alen + n + 1;
+  p = hex(p, sum);
+  for (i = alen - 1; i >= 0; i--) {
+    b = (addr >> (8 * i)) & 0xff;
+    p = hex(p, b);
+    sum += b;
+  }
+  for (i = 0; i < n; i++) {
+    p = hex(p, data[i]);
+    sum += data[i];
+  }
+  p = hex(p, ~sum & 0xff);
+  *p++ = '\n';
+  return p;
+}
+
+/*
+ * The records srec_cat would have written, S0 header and S5 count too,
+ * and the S7 runkernel tacked on by hand, but recsize data bytes to a
+ * record instead of 32: at 250 that is a sixth less down the cable.
+ */
+static int upload (struct upload *u, FILE *f, const char *name,
+		   unsigned long load, unsigned long entry, int recsize) {
+  static unsigned char in[RECS_PER_READ * SREC_MAX_DATA];
+  static char out[(RECS_PER_READ + 1) * SREC_MAX_TEXT];
+  unsigned long addr = load, nrec = 0;
+  size_t n, off, len;
+  char *p;
+
+  u->t0 = u->tlast = mono_ns();
+  p = srec_put(out, 0, 0, 2, (const unsigned char *)name,
+	       strlen(name) < SREC_MAX_DATA ? strlen(name) : SREC_MAX_DATA);
+  while ((n = fread(in, 1, recsize * RECS_PER_READ, f)) > 0) {
+    for (off = 0; off < n; off += len) {
+      len = n - off < recsize ? n - off : recsize;
+      p = srec_put(p, 3, addr, 4, in + off, len);
+      addr += len;
+      nrec++;
+    }
+    if (sink_write(u, out, p - out)) return -1;
+    p = out;
+    u->in += n;
+    progress(u, 0);
+  }
+  if (ferror(f)) {
+    perror(name);
+    return -1;
+  }
+  p = nrec <= 0xffff ? srec_put(p, 5, nrec, 2, NULL, 0)
+    : srec_put(p, 6, nrec, 3, NULL, 0);
+  p = srec_put(p, 7, entry, 4, NULL, 0);
+  if (sink_write(u, out, p - out)) return -1;
+  progress(u, 1);
+  return 0;
+}
+
+static void usage (const char *name) {
+  fprintf(stderr,
+	  "usage: %s [-T NAME] [-d DEV | -o FILE] [-a ADDR] [-e ADDR] [-L N] [-q]"
+	  " linux.bin\n"
+	  "  -T, --sink NAME    ppdev (default), file, or null to time the\n"
+	  "                     generator alone\n"
+	  "  -d, --device DEV   ppdev port (default %s)\n"
+	  "  -o, --output FILE  write the records to FILE (- for stdout)\n"
+	  "  -a, --load ADDR    where the image goes (default %#x)\n"
+	  "  -e, --entry ADDR   S7 start address (default the load address)\n"
+	  "  -L, --record N     data bytes per S3 record, up to %i (default)\n"
+	  "  -q, --quiet        no progress\n",
+	  name, DEFAULT_DEVICE, DEFAULT_LOAD, SREC_MAX_DATA);
+}
+
+int main (int argc, char **argv)
+{
+  static struct upload u;
+  const char *dev = DEFAULT_DEVICE, *output = NULL, *base;
+  unsigned long load = DEFAULT_LOAD, entry = 0;
+  int ret, i, recsize = SREC_MAX_DATA;
+  struct stat st;
+  FILE *f;
+  static const struct option opts[] = {
+    { "sink", required_argument, NULL, 'T' },
+    { "device", required_argument, NULL, 'd' },
+    { "output", required_argument, NULL, 'o' },
+    { "load", required_argument, NULL, 'a' },
+    { "entry", required_argument, NULL, 'e' },
+    { "record", required_argument, NULL, 'L' },
+    { "quiet", no_argument, NULL, 'q' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  u.ops = &pp_sink;
+  while ((ret = getopt_long(argc, argv, "T:d:o:a:e:L:qh", opts, NULL)) != -1) {
+    switch (ret) {
+    case 'T':
+      for (i = 0; i < sizeof(sinks) / sizeof(*sinks); i++)
+	if (!strcmp(optarg, sinks[i]->name)) break;
+      if (i == sizeof(sinks) / sizeof(*sinks)) {
+	fprintf(stderr, "%s: no sink called %s\n", argv[0], optarg);
+	return 1;
+      }
+      u.ops = sinks[i];
+      break;
+    case 'd':
+      dev = optarg;
+      break;
+    case 'o':
+      output = optarg;
+      u.ops = &file_sink;
+      break;
+    case 'a':
+      load = strtoul(optarg, NULL, 0);
+      break;
+    case 'e':
+      entry = strtoul(optarg, NULL, 0);
+      break;
+    case 'L':
+      recsize = atoi(optarg);
+      if (recsize < 1 || recsize > SREC_MAX_DATA) {
+	fprintf(stderr, "%s: records carry 1 to %i bytes\n", argv[0],
+		SREC_MAX_DATA);
+	return 1;
+      }
+      break;
+    case 'q':
+      u.quiet = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return ret == 'h' ? 0 : 1;
+    }
+  }
+  if (optind != argc - 1 || (u.ops == &file_sink && !output)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (!entry) entry = load;
+
+  for (i = 0; i < 256; i++) {
+    hexpair[i][0] = "0123456789ABCDEF"[i >> 4];
+    hexpair[i][1] = "0123456789ABCDEF"[i & 15];
+  }
+  f = strcmp(argv[optind], "-") ? fopen(argv[optind], "r") : stdin;
+  if (!f) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (!fstat(fileno(f), &st) && S_ISREG(st.st_mode)) u.size = st.st_size;
+  if (u.ops->open(&u, u.ops == &file_sink ? output : dev)) {
+    fclose(f);
+    return 1;
+  }
+  base = strrchr(argv[optind], '/');
+  ret = upload(&u, f, base ? base + 1 : argv[optind], load, entry, recsize);
+  u.ops->close(&u);
+  fclose(f);
+  return ret ? 1 : 0;
+}
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+/*
+ * MB/s of the long word at a time strlen, strcpy, strcmp, strncmp and
+ * memchr in platform/dj/string.S next to lib/string.c's byte loops,
+ * which are what a ColdFire kernel gets otherwise.  Everything is
+ * checked against lib's first, over every length to CHECK_LEN at every
+ * alignment, with bytes over 0x7f, guard bytes and all.  As a flat
+ * binary, for the printer or for qemu, which loads those too:
+ *
+ *   m68k-uclinux-gcc -mcpu=5206 -O2 -Wl,-elf2flt -DDJ_MEM_BENCH -o strbench \
+ *     strbench.c ../linux-2.6.x/arch/m68knommu/platform/dj/string.S
+ *   qemu-m68k -cpu cfv4e ./strbench
+ *
+ * or with m68k-linux-gnu-gcc -static and "qemu-m68k -cpu any".  As with
+ * membench, qemu's numbers say which is less work, not how fast the
+ * printer does it.  Built for anything else, the lib versions stand in
+ * for string.S's so the harness itself can be tried out.
+ */
+
+/* Longest string timed, and the slack either side for alignment and guards */
+#define MAX_LEN 16384
+#define SLACK 64
+#define GUARD 0xa5
+/* Lengths checked exhaustively, at every alignment */
+#define CHECK_LEN 80
+
+typedef size_t (*strlen_fn) (const char *s);
+typedef char *(*strcpy_fn) (char *dst, const char *src);
+typedef int (*strcmp_fn) (const char *cs, const char *ct);
+typedef int (*strncmp_fn) (const char *cs, const char *ct, size_t n);
+typedef void *(*memchr_fn) (const void *s, int c, size_t n);
+
+/*
+ * lib/string.c's, but comparing unsigned chars: its strcmp and strncmp
+ * take the difference as a signed char, so they order bytes over 0x7f
+ * wrongly, which string.S doesn't copy.
+ */
+static size_t lib_strlen (const char *s) {
+  const char *sc;
+
+  for (sc = s; *sc != '\0'; ++sc)
+    /* nothing */;
+  return sc - s;
+}
+
+static char *lib_strcpy (char *dest, const char *src) {
+  char *tmp = dest;
+
+  while ((*dest++ = *src++) != '\0')
+    /* nothing */;
+  return tmp;
+}
+
+static int lib_strcmp (const char *cs, const char *ct) {
+  unsigned char c1, c2;
+
+  while (1) {
+    c1 = *cs++;
+    c2 = *ct++;
+    if (c1 != c2) return c1 - c2;
+    if (!c1) break;
+  }
+  return 0;
+}
+
+static int lib_strncmp (const char *cs, const char *ct, size_t count) {
+  unsigned char c1, c2;
+
+  while (count) {
+    c1 = *cs++;
+    c2 = *ct++;
+    if (c1 != c2) return c1 - c2;
+    if (!c1) break;
+    count--;
+  }
+  return 0;
+}
+
+static void *lib_memchr (const void *s, int c, size_t n) {
+  const unsigned char *p = s;
+
+  while (n-- != 0) {
+    if ((unsigned char) c == *p++) return (void *) (p - 1);
+  }
+  return NULL;
+}
+
+#ifdef __m68k__
+extern size_t dj_strlen (const char *s);
+extern char *dj_strcpy (char *dst, const char *src);
+extern int dj_strcmp (const char *cs, const char *ct);
+extern int dj_strncmp (const char *cs, const char *ct, size_t n);
+extern void *dj_memchr (const void *s, int c, size_t n);
+#else
+#define dj_strlen lib_strlen
+#define dj_strcpy lib_strcpy
+#define dj_strcmp lib_strcmp
+#define dj_strncmp lib_strncmp
+#define dj_memchr lib_memchr
+#endif
+
+static const struct {
+  const char *name;
+  strlen_fn len;
+  strcpy_fn cpy;
+  strcmp_fn cmp;
+  strncmp_fn ncmp;
+  memchr_fn chr;
+} impls[] = {
+  { "lib", lib_strlen, lib_strcpy, lib_strcmp, lib_strncmp, lib_memchr },
+  { "dj", dj_strlen, dj_strcpy, dj_strcmp, dj_strncmp, dj_memchr },
+};
+#define NIMPLS (sizeof(impls) / sizeof(*impls))
+
+enum { F_STRLEN, F_STRCPY, F_STRCMP, F_STRNCMP, F_MEMCHR, NFUNCS };
+static const char *const fnames[NFUNCS] = {
+  "strlen", "strcpy", "strcmp", "strncmp", "memchr"
+};
+
+static const size_t lens[] = { 3, 8, 16, 32, 64, 256, 1024, MAX_LEN };
+#define NLENS (sizeof(lens) / sizeof(*lens))
+
+/* First and second string offsets from a long word */
+static const struct { int a, b; } aligns[] = {
+  { 0, 0 }, { 1, 1 }, { 3, 3 }, { 0, 1 }, { 0, 2 },
+};
+#define NALIGNS (sizeof(aligns) / sizeof(*aligns))
+
+static char abuf[MAX_LEN + 2 * SLACK] __attribute__ ((aligned (16)));
+static char bbuf[MAX_LEN + 2 * SLACK] __attribute__ ((aligned (16)));
+static char dbuf[MAX_LEN + 2 * SLACK] __attribute__ ((aligned (16)));
+static char rbuf[MAX_LEN + 2 * SLACK] __attribute__ ((aligned (16)));
+
+static unsigned long long mono_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sign (int x) {
+  return (x > 0) - (x < 0);
+}
+
+/*****************************************************************************/
+
+static unsigned seed = 1;
+
+/* Anything but NUL, a good share of it over 0x7f */
+static unsigned char rnd_byte (void) {
+  unsigned char c;
+
+  do c = (seed = seed * 1103515245 + 12345) >> 16;
+  while (!c);
+  return c;
+}
+
+/* A string of len at a, the same at b, guards all around both */
+static void mkstr (char *a, char *b, size_t len) {
+  size_t i;
+
+  memset(abuf, GUARD, sizeof(abuf));
+  memset(bbuf, GUARD, sizeof(bbuf));
+  for (i = 0; i < len; i++) a[i] = b[i] = rnd_byte();
+  a[len] = b[len] = 0;
+}
+
+static int report (int impl, int f, size_t len, int aoff, int boff,
+		   const char *what) {
+  fprintf(stderr, "%s %s wrong: %lu bytes, +%i, +%i, %s\n",
+	  impls[impl].name, fnames[f], (unsigned long) len, aoff, boff, what);
+  return -1;
+}
+
+static int check_one (int impl, size_t len, int aoff, int boff) {
+  char *a = abuf + SLACK + aoff, *b = bbuf + SLACK + boff;
+  char *d = dbuf + SLACK + boff, *r = rbuf + SLACK + boff;
+  size_t i, n;
+  int bad = 0;
+
+  mkstr(a, b, len);
+  if (impls[impl].len(a) != len)
+    bad = report(impl, F_STRLEN, len, aoff, boff, "length");
+
+  memset(dbuf, GUARD, sizeof(dbuf));
+  memset(rbuf, GUARD, sizeof(rbuf));
+  lib_strcpy(r, a);
+  if (impls[impl].cpy(d, a) != d || memcmp(dbuf, rbuf, sizeof(dbuf)))
+    bad = report(impl, F_STRCPY, len, aoff, boff, "copy");
+
+  /* Equal, then differing at each place in turn, either way round */
+  if (impls[impl].cmp(a, b) || impls[impl].ncmp(a, b, len + 5))
+    bad = report(impl, F_STRCMP, len, aoff, boff, "equal");
+  for (i = 0; i <= len; i++) {
+    char save = b[i];
+
+    b[i] = i & 1 ? (char) (a[i] ^ 0x80) : 0;
+    if (sign(impls[impl].cmp(a, b)) != sign(lib_strcmp(a, b)) ||
+	sign(impls[impl].cmp(b, a)) != sign(lib_strcmp(b, a)))
+      bad = report(impl, F_STRCMP, len, aoff, boff, "order");
+    for (n = i ? i - 1 : 0; n <= i + 1; n++)
+      if (sign(impls[impl].ncmp(a, b, n)) != sign(lib_strncmp(a, b, n)))
+	bad = report(impl, F_STRNCMP, len, aoff, boff, "order");
+    b[i] = save;
+  }
+
+  /* Every byte of a found where it first is, or not found past n */
+  for (i = 0; i <= len; i++)
+    for (n = i ? i - 1 : 0; n <= i + 1; n++)
+      if (impls[impl].chr(a, a[i] | 0x100, n) != lib_memchr(a, a[i], n))
+	bad = report(impl, F_MEMCHR, len, aoff, boff, "match");
+  return bad;
+}
+
+static int check (void) {
+  int impl, aoff, boff, bad = 0;
+  size_t len;
+
+  for (impl = 0; impl < NIMPLS; impl++)
+    for (len = 0; len < CHECK_LEN; len++)
+      for (aoff = 0; aoff < 4; aoff++)
+	for (boff = 0; boff < 4; boff++)
+	  if (check_one(impl, len, aoff, boff) && ++bad > 20) return -1;
+  for (impl = 0; impl < NIMPLS; impl++) {
+    mkstr(abuf + SLACK + 1, bbuf + SLACK + 3, MAX_LEN);
+    if (impls[impl].len(abuf + SLACK + 1) != MAX_LEN ||
+	impls[impl].cmp(abuf + SLACK + 1, bbuf + SLACK + 3))
+      bad = report(impl, F_STRLEN, MAX_LEN, 1, 3, "long string");
+  }
+  return bad ? -1 : 0;
+}
+
+/*****************************************************************************/
+
+/*
+ * MB/s for going over about total bytes of strings len long.  strcmp
+ * and strncmp get two equal ones, so they go all the way; memchr looks
+ * for a byte that isn't there.
+ */
+static double bench_one (int impl, int f, size_t len, int aoff, int boff,
+			 unsigned long total) {
+  char *a = abuf + SLACK + aoff, *b = bbuf + SLACK + boff;
+  char *d = dbuf + SLACK + boff;
+  unsigned long reps = total / (len + 1), i;
+  unsigned long long t;
+  volatile unsigned long sink = 0;
+
+  if (!reps) reps = 1;
+  t = mono_ns();
+  switch (f) {
+  case F_STRLEN:
+    for (i = 0; i < reps; i++) sink += impls[impl].len(a);
+    break;
+  case F_STRCPY:
+    for (i = 0; i < reps; i++) impls[impl].cpy(d, a);
+    break;
+  case F_STRCMP:
+    for (i = 0; i < reps; i++) sink += impls[impl].cmp(a, b);
+    break;
+  case F_STRNCMP:
+    for (i = 0; i < reps; i++) sink += impls[impl].ncmp(a, b, len + 1);
+    break;
+  case F_MEMCHR:
+    for (i = 0; i < reps; i++) sink += !!impls[impl].chr(a, 0, len);
+    break;
+  }
+  t = mono_ns() - t;
+  if (!t) t = 1;
+  return (double) reps * (len + 1) * 1000.0 / t;
+}
+
+static void bench (int f, unsigned long total) {
+  int a, impl, k;
+
+  printf("\n%s, MB/s\n%6s %4s %4s", fnames[f], "len", "a", "b");
+  for (impl = 0; impl < NIMPLS; impl++) printf(" %9s", impls[impl].name);
+  printf("\n");
+  for (k = 0; k < NLENS; k++)
+    for (a = 0; a < NALIGNS; a++) {
+      /* strlen and memchr only have the one string */
+      int two = f == F_STRCPY || f == F_STRCMP || f == F_STRNCMP;
+
+      if (!two && aligns[a].b != aligns[a].a) continue;
+      mkstr(abuf + SLACK + aligns[a].a, bbuf + SLACK + aligns[a].b, lens[k]);
+      printf("%6lu %4i", (unsigned long) lens[k], aligns[a].a);
+      if (two) printf(" %4i", aligns[a].b);
+      else printf(" %4s", "");
+      for (impl = 0; impl < NIMPLS; impl++)
+	printf(" %9.2f", bench_one(impl, f, lens[k], aligns[a].a,
+				   aligns[a].b, total));
+      printf("\n");
+      fflush(stdout);
+    }
+}
+
+static void usage (const char *name) {
+  fprintf(stderr,
+	  "usage: %s [-m MB] [-c]\n"
+	  "  -m, --megs MB   bytes gone over per measurement (default 4)\n"
+	  "  -c, --check     only check the results, don't time them\n",
+	  name);
+}
+
+int main (int argc, char **argv)
+{
+  unsigned long total = 4UL << 20;
+  int ret, f, only_check = 0;
+  static const struct option opts[] = {
+    { "megs", required_argument, NULL, 'm' },
+    { "check", no_argument, NULL, 'c' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while ((ret = getopt_long(argc, argv, "m:ch", opts, NULL)) != -1) {
+    switch (ret) {
+    case 'm':
+      total = strtoul(optarg, NULL, 0) << 20;
+      if (!total) {
+	fprintf(stderr, "%s: at least a megabyte\n", argv[0]);
+	return 1;
+      }
+      break;
+    case 'c':
+      only_check = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return ret == 'h' ? 0 : 1;
+    }
+  }
+  if (optind != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (check()) return 1;
+  printf("all %u checked against lib/string.c\n", (unsigned) NIMPLS);
+  if (only_check) return 0;
+  for (f = 0; f < NFUNCS; f++) bench(f, total);
+  return 0;
+}